@@ -51,9 +51,6 @@
 #include "ppr_transform.hpp"
 #include <charconv>
 
-namespace ppr {
-  class transform;
-}
 #ifndef YY_NULLPTR
 #  define YY_NULLPTR nullptr
 #endif
@@ -742,9 +742,14 @@ static const flex_int16_t yy_chk[308] =
 #define YY_RESTORE_YY_MORE_OFFSET
 
 #include <cassert>
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory_resource>
 #include <string>
 #include <string_view>
+#include <ppr_token_pipe.hpp>
 #include <ppr_tokenizer.hpp>
 
 #define YY_READ_BUF_SIZE 512
@@ -755,6 +760,26 @@ static const flex_int16_t yy_chk[308] =
 
 #define yyterminate()		ctx.end();
 #define YY_USER_ACTION  ctx.columns(yyleng);
+// Characters no rule matches are reported, not written to stdout. Right after a '#' a newline ends a null
+// directive and is scanned as code, and a digit starts a line marker (# 1 "file") skipped with its line.
+#define ECHO                                              \
+  do                                                      \
+  {                                                       \
+    if (YY_START != pprdirective)                         \
+      ctx.unmatched(yyleng);                              \
+    else if (yytext[0] == '\n' || yytext[0] == '\r')      \
+    {                                                     \
+      BEGIN(pprcode);                                     \
+      yyless(0);                                          \
+    }                                                     \
+    else if (yytext[0] >= '0' && yytext[0] <= '9')        \
+    {                                                     \
+      BEGIN(pprcode);                                     \
+      ctx.elide(ctx.skip_line_marker());                  \
+    }                                                     \
+    else                                                  \
+      ctx.unmatched(yyleng);                              \
+  } while (0)
 
 void* pprtok_alloc   (std::size_t bytes, void* yyscanner);
 void* pprtok_realloc (void* ptr, std::size_t bytes, void* yyscanner);
@@ -1223,14 +1248,26 @@ YY_RULE_SETUP
 case 22:
 YY_RULE_SETUP
 {
-                             ctx.start_read_len(yyleng);
-                             BEGIN(pprcomment);
+                             if (auto len = ctx.scan_block_comment())
+                             {
+                               if (!ctx.elide_comments())
+                                 return ctx.make_blk_comment(len);
+                               ctx.elide(len);
+                             }
+                             else
+                             {
+                               // Unterminated, the comment state consumes the rest
+                               ctx.start_read_len(yyleng);
+                               BEGIN(pprcomment);
+                             }
                            }
 	YY_BREAK
 case 23:
 YY_RULE_SETUP
 {
-                             return ctx.make_sl_comment(yyleng);
+                             if (!ctx.elide_comments())
+                               return ctx.make_sl_comment(yyleng);
+                             ctx.elide(yyleng);
                            }
 	YY_BREAK
 case 24:
@@ -1311,7 +1348,9 @@ case 35:
 YY_RULE_SETUP
 {
                              BEGIN(pprcode);
-                             return ctx.make_blk_comment(ctx.flush_read_len() + yyleng); 
+                             if (!ctx.elide_comments())
+                               return ctx.make_blk_comment(ctx.flush_read_len() + yyleng);
+                             ctx.elide(ctx.flush_read_len() + yyleng);
                            }
 	YY_BREAK
 
@@ -2528,36 +2567,47 @@ static int yy_flex_strlen (const char * s , yyscan_t yyscanner)
 }
 #endif
 
-void *yyalloc (yy_size_t  size , yyscan_t yyscanner)
+#define YYTABLES_NAME "yytables"
+
+// Scanner memory comes from the tokenizer's memory resource. A header keeps the block size
+// that memory_resource needs on release and flex does not pass back.
+static constexpr std::size_t pprtok_header = alignof(std::max_align_t);
+
+static std::pmr::memory_resource* pprtok_resource(void* yyscanner)
 {
-	struct yyguts_t * yyg = (struct yyguts_t*)yyscanner;
-	(void)yyg;
-	return malloc(size);
+  auto yyg = static_cast<struct yyguts_t*>(yyscanner);
+  return (yyg && yyg->yyextra_r) ? yyg->yyextra_r->get_memory_resource() : std::pmr::get_default_resource();
 }
 
-void *yyrealloc  (void * ptr, yy_size_t  size , yyscan_t yyscanner)
+void* pprtok_alloc(std::size_t bytes, void* yyscanner)
 {
-	struct yyguts_t * yyg = (struct yyguts_t*)yyscanner;
-	(void)yyg;
-
-	/* The cast to (char *) in the following accommodates both
-	 * implementations that use char* generic pointers, and those
-	 * that use void* generic pointers.  It works with the latter
-	 * because both ANSI C and C++ allow castless assignment from
-	 * any pointer type to void*, and deal with argument conversions
-	 * as though doing an assignment.
-	 */
-	return realloc(ptr, size);
+  auto block = static_cast<char*>(pprtok_resource(yyscanner)->allocate(bytes + pprtok_header, pprtok_header));
+  std::memcpy(block, &bytes, sizeof(bytes));
+  return block + pprtok_header;
 }
 
-void yyfree (void * ptr , yyscan_t yyscanner)
+void* pprtok_realloc(void* ptr, std::size_t bytes, void* yyscanner)
 {
-	struct yyguts_t * yyg = (struct yyguts_t*)yyscanner;
-	(void)yyg;
-	free( (char *) ptr );	/* see yyrealloc() for (char *) cast */
+  if (!ptr)
+    return pprtok_alloc(bytes, yyscanner);
+  std::size_t prev = 0;
+  std::memcpy(&prev, static_cast<char*>(ptr) - pprtok_header, sizeof(prev));
+  auto block = pprtok_alloc(bytes, yyscanner);
+  std::memcpy(block, ptr, std::min(prev, bytes));
+  pprtok_free(ptr, yyscanner);
+  return block;
 }
 
-#define YYTABLES_NAME "yytables"
+void pprtok_free(void* ptr, void* yyscanner)
+{
+  if (!ptr)
+    return;
+  auto        mr    = pprtok_resource(yyscanner);
+  auto        block = static_cast<char*>(ptr) - pprtok_header;
+  std::size_t bytes = 0;
+  std::memcpy(&bytes, block, sizeof(bytes));
+  mr->deallocate(block, bytes + pprtok_header, pprtok_header);
+}
 
 namespace ppr
 {
@@ -2575,5 +2625,124 @@ void tokenizer::end_scan()
   token_scanner = nullptr;
 }
 
+void tokenizer::reset(std::string_view source)
+{
+  auto yyg           = static_cast<struct yyguts_t*>(token_scanner);
+  content            = source;
+  location           = {};
+  whitespaces        = 0;
+  pos                = 0;
+  pos_commit         = 0;
+  len_reading        = 0;
+  ahead              = false;
+  elide_all_comments = false;
+  pipe               = nullptr;
+  BEGIN(INITIAL);
+  // Refills from the new source, at the beginning of a line
+  yy_flush_buffer(YY_CURRENT_BUFFER, token_scanner);
+}
+
+void tokenizer::skip_to(std::int32_t offset, int line_count)
+{
+  if (pipe)
+  {
+    // The pipe scanned the skipped lines, a token peeked past the offset is kept
+    if (!ahead || lookahead.value.td.start < offset)
+    {
+      ahead = false;
+      pipe->skip_to(offset);
+    }
+    return;
+  }
+  auto yyg    = static_cast<struct yyguts_t*>(token_scanner);
+  pos         = offset;
+  pos_commit  = offset;
+  whitespaces = 0;
+  ahead       = false;
+  if (line_count)
+    lines(line_count);
+  yy_flush_buffer(YY_CURRENT_BUFFER, token_scanner);
+}
+
+// Moves the scanner from the end of the current match, at source offset `from`, on to `to` without scanning
+// the text between. Stays in flex's buffer when it holds `to`, otherwise reading starts over at `to`.
+void tokenizer::jump(std::int32_t from, std::int32_t to)
+{
+  auto yyg   = static_cast<struct yyguts_t*>(token_scanner);
+  auto count = to - from;
+  if (count < YY_CURRENT_BUFFER_LVALUE->yy_ch_buf + yyg->yy_n_chars - yyg->yy_c_buf_p)
+  {
+    *yyg->yy_c_buf_p  = yyg->yy_hold_char;
+    yyg->yy_c_buf_p  += count;
+    yyg->yy_hold_char = *yyg->yy_c_buf_p;
+    *yyg->yy_c_buf_p  = '\0';
+  }
+  else
+  {
+    pos = to;
+    yy_flush_buffer(YY_CURRENT_BUFFER, token_scanner);
+    // Mid-line, a '#' that follows is not a directive
+    YY_CURRENT_BUFFER_LVALUE->yy_at_bol = 0;
+  }
+}
+
+std::int32_t tokenizer::scan_block_comment()
+{
+  // Just past "/*", its '*' does not close the comment
+  auto const from = pos_commit + 2;
+  auto const data = content.data();
+  auto const size = static_cast<std::int32_t>(content.size());
+
+  std::int32_t end = -1;
+  for (auto i = from; i < size;)
+  {
+    auto slash = static_cast<char const*>(std::memchr(data + i, '/', static_cast<std::size_t>(size - i)));
+    if (!slash)
+      break;
+    auto at = static_cast<std::int32_t>(slash - data);
+    if (at > from && data[at - 1] == '*')
+    {
+      end = at + 1;
+      break;
+    }
+    i = at + 1;
+  }
+  if (end < 0)
+    return 0;
+
+  int          count = 0;
+  std::int32_t line  = from;
+  for (auto i = from; i < end;)
+  {
+    auto nl = static_cast<char const*>(std::memchr(data + i, '\n', static_cast<std::size_t>(end - i)));
+    if (!nl)
+      break;
+    i    = static_cast<std::int32_t>(nl - data) + 1;
+    line = i;
+    count++;
+  }
+  if (count)
+    lines(count);
+  columns(end - line);
+
+  jump(from, end);
+  return end - pos_commit;
+}
+
+std::int32_t tokenizer::skip_line_marker()
+{
+  // Just past the first digit, the newline and any '\r' before it are left to the scanner
+  auto const from = pos_commit + 1;
+  auto const data = content.data();
+  auto const size = static_cast<std::int32_t>(content.size());
+  auto       nl   = static_cast<char const*>(std::memchr(data + from, '\n', static_cast<std::size_t>(size - from)));
+  auto       end  = nl ? static_cast<std::int32_t>(nl - data) : size;
+  while (end > from && data[end - 1] == '\r')
+    end--;
+  columns(end - from);
+  jump(from, end);
+  return end - pos_commit;
+}
+
 }
 
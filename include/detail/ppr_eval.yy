@@ -19,9 +19,6 @@
 #include "ppr_transform.hpp"
 #include <charconv>
 
-namespace ppr {
-  class transform;
-}
 #ifndef YY_NULLPTR
 #  define YY_NULLPTR nullptr
 #endif
@@ -154,13 +151,13 @@ void parser_impl::error(location_type const& l,
   ctx.push_error(e, " bison ", l.begin);
 }
 
-ppr::eval_type transform::eval(ppr::live_eval& eval) 
+ppr::eval_type live_eval::evaluate()
 {
-	parser_impl parser(eval);
+	parser_impl parser(*this);
 	//parser.set_debug_level(flags_ & ppr::impl::debug);
 	
 	parser.parse();
-	return eval.result;
+	return result;
 }
 
 }
@@ -1,10 +1,25 @@
 
-// #define PPR_SMALL_VECTOR boost::small_vector // to use stack allocations
+// #define PPR_SMALL_VECTOR boost::small_vector // to replace the built-in ppr::small_vector
 
+#include "ppr_arena.hpp"
 #include "ppr_common.hpp"
+#include "ppr_small_vector.hpp"
 #include "ppr_eval_type.hpp"
 #include "ppr_loc.hpp"
+#include "ppr_mapped_source.hpp"
 #include "ppr_token.hpp"
 #include "ppr_sink.hpp"
+#include "ppr_batch_sink.hpp"
+#include "ppr_range_sink.hpp"
+#include "ppr_fd_sink.hpp"
+#include "ppr_binary_stream.hpp"
+#include "ppr_macro_environment.hpp"
+#include "ppr_source_map.hpp"
+#include "ppr_token_pipe.hpp"
 #include "ppr_tokenizer.hpp"
 #include "ppr_transform.hpp"
+#include "ppr_batch.hpp"
+
+#ifdef PPR_IMPLEMENT
+#include "ppr_transform_impl.hpp"
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+namespace ppr
+{
+
+// Append-only character storage, strings handed out stay valid until clear()
+class string_arena
+{
+public:
+  static constexpr std::size_t max_block_size = 4 * 1024 * 1024;
+
+  string_arena(std::pmr::memory_resource* mr = std::pmr::get_default_resource(), std::size_t block = 16 * 1024)
+      : blocks(mr), block_size(block)
+  {}
+
+  string_arena(string_arena&& other) noexcept
+      : blocks(std::move(other.blocks)), current(std::exchange(other.current, {})),
+        head(std::exchange(other.head, nullptr)), left(std::exchange(other.left, 0)), block_size(other.block_size)
+  {}
+
+  // Drops the strings stored here, both arenas must allocate from the same memory resource
+  string_arena& operator=(string_arena&& other) noexcept
+  {
+    string_arena dropped(std::move(*this));
+    swap(other);
+    return *this;
+  }
+
+  string_arena(string_arena const&)            = delete;
+  string_arena& operator=(string_arena const&) = delete;
+
+  ~string_arena()
+  {
+    release();
+    if (current.data)
+      resource()->deallocate(current.data, current.size, 1);
+  }
+
+  std::pmr::memory_resource* resource() const
+  {
+    return blocks.get_allocator().resource();
+  }
+
+  char* allocate(std::size_t len)
+  {
+    if (len > left)
+      grow(len);
+    auto r = head;
+    head += len;
+    left -= len;
+    return r;
+  }
+
+  std::string_view store(std::string_view sv)
+  {
+    if (sv.empty())
+      return {};
+    auto dst = allocate(sv.size());
+    std::memcpy(dst, sv.data(), sv.size());
+    return std::string_view{dst, sv.size()};
+  }
+
+  std::string_view concat(std::string_view a, std::string_view b)
+  {
+    auto dst = allocate(a.size() + b.size());
+    std::memcpy(dst, a.data(), a.size());
+    std::memcpy(dst + a.size(), b.data(), b.size());
+    return std::string_view{dst, a.size() + b.size()};
+  }
+
+  // Blocks grow geometrically so this stays a handful of compares
+  bool owns(char const* p) const
+  {
+    if (p >= current.data && p < current.data + current.size)
+      return true;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it)
+    {
+      if (p >= it->data && p < it->data + it->size)
+        return true;
+    }
+    return false;
+  }
+
+  // Exchanges the stored strings, both arenas must allocate from the same memory resource
+  void swap(string_arena& other) noexcept
+  {
+    blocks.swap(other.blocks);
+    std::swap(current, other.current);
+    std::swap(head, other.head);
+    std::swap(left, other.left);
+    std::swap(block_size, other.block_size);
+  }
+
+  // Keeps the most recent, and largest grown, block for reuse
+  void clear()
+  {
+    release();
+    head = current.data;
+    left = current.size;
+  }
+
+private:
+  // The block in use is kept apart, an arena holding a few short strings makes a single allocation
+  void grow(std::size_t len)
+  {
+    auto size = len > block_size ? len : block_size;
+    if (current.data)
+      blocks.push_back(current);
+    current    = {static_cast<char*>(resource()->allocate(size, 1)), size};
+    head       = current.data;
+    left       = size;
+    block_size = block_size * 2 > max_block_size ? max_block_size : block_size * 2;
+  }
+
+  // Frees the filled blocks
+  void release()
+  {
+    for (auto const& b : blocks)
+      resource()->deallocate(b.data, b.size, 1);
+    blocks.clear();
+  }
+
+  struct block
+  {
+    char*       data = nullptr;
+    std::size_t size = 0;
+  };
+
+  std::pmr::vector<block> blocks;
+  block              current;
+  char*              head       = nullptr;
+  std::size_t        left       = 0;
+  std::size_t        block_size = 0;
+};
+
+} // namespace ppr
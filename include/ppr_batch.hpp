@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ppr_common.hpp"
+#include "ppr_macro_environment.hpp"
+#include "ppr_transform.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace ppr
+{
+
+// Preprocesses many sources at once on a pool of threads. Jobs are dealt round-robin to per-worker queues,
+// a worker takes its own from the front and, once out of work, steals from the back of the others. Each
+// worker keeps one memory pool and one transform, reset between jobs. A job starts from its environment
+// alone and writes to its own sink, so what a sink receives does not depend on the number of threads or on
+// the scheduling.
+class PPR_API batch
+{
+public:
+  struct job
+  {
+    // Must stay valid until run returns
+    std::string_view                         source;
+    // Definitions the job starts with, none when null
+    std::shared_ptr<macro_environment const> environment;
+    // A job without an output is not run, it is reported failed and done
+    sink*                                    output = nullptr;
+    // Set by run, the transform reported an error
+    bool                                     failed = false;
+  };
+
+  // Called on the worker before a job is preprocessed, with the job's index, to set transform options.
+  // Options stay from the worker's previous job, set every one that differs between jobs.
+  using setup_fn = std::function<void(transform&, std::size_t)>;
+  // Called on the worker once a job is done and its sink flushed
+  using done_fn  = std::function<void(std::size_t)>;
+
+  // 0 threads picks std::thread::hardware_concurrency
+  explicit batch(unsigned threads = 0);
+
+  void set_setup(setup_fn f)
+  {
+    setup = std::move(f);
+  }
+
+  void set_done(done_fn f)
+  {
+    done = std::move(f);
+  }
+
+  unsigned threads() const
+  {
+    return thread_count;
+  }
+
+  // Returns once every job is done, the number of failed jobs
+  std::size_t run(std::span<job> jobs);
+
+private:
+  struct queue;
+
+  void work(std::span<job> jobs, std::span<queue> queues, std::size_t self);
+  void process(transform& ctx, job& j, std::size_t index);
+
+  setup_fn setup;
+  done_fn  done;
+  unsigned thread_count;
+};
+
+} // namespace ppr
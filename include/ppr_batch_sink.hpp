@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ppr_arena.hpp"
+#include "ppr_sink.hpp"
+#include <deque>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace ppr
+{
+
+// Sink receiving tokens a line at a time, or `capacity` tokens at a time when a line runs longer.
+// Tokens produced by macro handling are copied into the batch along with their text, so a batch is
+// self-contained until handle_batch returns. Tokens from the source, and their values, view the source.
+class batch_sink : public sink
+{
+public:
+  batch_sink(std::size_t capacity = 1024, int max_consequitive_empty_lines = 1, bool ignore_all_comments = true)
+      : sink(max_consequitive_empty_lines, ignore_all_comments), batch_capacity(capacity ? capacity : 1)
+  {
+    // Reserved up front, batch tokens point into rtokens
+    batch_tokens.reserve(batch_capacity);
+    batch_values.reserve(batch_capacity);
+    rtokens.reserve(batch_capacity);
+  }
+
+  // values[i] is the leading whitespace and text of tokens[i]
+  virtual void handle_batch(std::span<token const> tokens, std::span<symvalue const> values) = 0;
+
+  void handle(token const& t, symvalue const& data) final
+  {
+    bool newline = t.type == token_type::ty_newline;
+    switch (t.type)
+    {
+    case token_type::ty_rtoken:
+    {
+      auto& rt    = rtokens.emplace_back(*t.value.rt);
+      rt.value    = text.store(rt.value);
+      auto& bt    = batch_tokens.emplace_back(t);
+      bt.value.rt = &rt;
+      batch_values.emplace_back(rt.sspace(), rt.svalue());
+      newline = rt.type == token_type::ty_newline;
+    }
+    break;
+    case token_type::ty_raw:
+    {
+      auto& r      = raw.emplace_back(text.store(*t.value.raw));
+      auto& bt     = batch_tokens.emplace_back(t);
+      bt.value.raw = &r;
+      batch_values.emplace_back(std::string_view{}, r);
+    }
+    break;
+    default:
+      batch_tokens.push_back(t);
+      batch_values.push_back(data);
+      break;
+    }
+    if (newline || batch_tokens.size() == batch_capacity)
+      flush();
+  }
+
+  void flush() override
+  {
+    if (batch_tokens.empty())
+      return;
+    handle_batch(batch_tokens, batch_values);
+    batch_tokens.clear();
+    batch_values.clear();
+    rtokens.clear();
+    raw.clear();
+    text.clear();
+  }
+
+private:
+  std::vector<token>    batch_tokens;
+  std::vector<symvalue> batch_values;
+  std::vector<rtoken>   rtokens;
+  // Recorded text of disabled #if conditions
+  std::deque<std::string_view> raw;
+  string_arena                 text{std::pmr::get_default_resource(), 4 * 1024};
+  std::size_t             batch_capacity;
+};
+
+} // namespace ppr
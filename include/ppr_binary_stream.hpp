@@ -0,0 +1,133 @@
+#pragma once
+
+#include "ppr_sink.hpp"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ppr
+{
+
+// Binary token stream, all numbers are LEB128 varints:
+//   header   "PPRB", version byte, flags byte (bit 0: records carry locations)
+//   record   kind byte: token_type in the low 5 bits, bit 5 text payload, bit 6 leading whitespace,
+//            bit 7 was_disabled. Then the payload:
+//              ty_operator, ty_bracket, ty_braces  operator character
+//              ty_operator2                        operator2_type
+//              ty_keyword_ident                    identifier index, a new index is followed by the name
+//              ty_*integer                         value, sign byte, suffix (length and bytes)
+//              ty_true, ty_false, ty_newline       nothing
+//              text payload and anything else      length and bytes
+//            then, with locations, the zigzag line delta to the previous record and the column.
+// An integer is stored as its value only when the value spells it back: decimal, 0 then octal digits or
+// 0x then upper case hex digits, without leading zeros, with an optional '-' and the suffix after it. Other
+// spellings (0X, 0x0FF, 007, +1) and values that do not fit 64 bits are kept as text, so every token's text
+// is given back exactly.
+namespace binary_stream
+{
+constexpr char          magic[4]       = {'P', 'P', 'R', 'B'};
+constexpr std::uint8_t  version        = 1;
+constexpr std::uint8_t  with_locations = 1;
+constexpr std::uint8_t  type_mask      = 0x1f;
+constexpr std::uint8_t  text_payload   = 0x20;
+constexpr std::uint8_t  has_space      = 0x40;
+constexpr std::uint8_t  disabled       = 0x80;
+constexpr std::uint32_t header_size    = 6;
+} // namespace binary_stream
+
+// Serializes the tokens it receives, macro expansions included, into the binary stream format
+class PPR_API binary_sink final : public sink
+{
+public:
+  binary_sink(bool locations = false, int max_consequitive_empty_lines = 1, bool ignore_all_comments = true);
+
+  void handle(token const& t, symvalue const& data) override;
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override;
+
+  std::span<std::uint8_t const> data() const
+  {
+    return stream;
+  }
+
+  std::vector<std::string> const& errors() const
+  {
+    return messages;
+  }
+
+  // Starts a new stream, identifiers are interned again
+  void clear();
+
+private:
+  void put(std::uint64_t v);
+  void put(std::string_view text);
+
+  using ident_map = std::unordered_map<std::string, std::uint32_t, ppr::str_hash, ppr::str_equal_test>;
+
+  std::vector<std::uint8_t> stream;
+  ident_map                 idents;
+  std::vector<std::string>  messages;
+  std::int32_t              last_line = 0;
+  bool                      locations = false;
+};
+
+// A token read back from a binary stream, text views the stream
+struct binary_token
+{
+  token_type       type     = token_type::ty_eof;
+  bool             disabled = false;
+  bool             space    = false;
+  union
+  {
+    operator_type  op = 0;
+    operator2_type op2;
+  };
+  // Identifier index, for ty_keyword_ident
+  std::uint32_t    ident    = 0;
+  std::uint64_t    value    = 0;
+  bool             negative = false;
+  // Read as a text payload, `text` is the whole token and value is not set
+  bool             verbatim = false;
+  // Identifier name, operator character, integer suffix or the token text, empty for ty_operator2
+  std::string_view text;
+  loc              location;
+};
+
+class PPR_API binary_reader
+{
+public:
+  binary_reader(std::span<std::uint8_t const> stream);
+
+  // False at the end of the stream, or if it is malformed
+  bool next(binary_token& t);
+
+  bool failed() const
+  {
+    return bad;
+  }
+
+  bool has_locations() const
+  {
+    return locations;
+  }
+
+  // Names by identifier index
+  std::vector<std::string_view> const& identifiers() const
+  {
+    return names;
+  }
+
+private:
+  bool get(std::uint64_t& v);
+  bool get(std::string_view& text);
+
+  std::span<std::uint8_t const> in;
+  std::size_t                   pos = binary_stream::header_size;
+  std::vector<std::string_view> names;
+  std::int32_t                  line      = 0;
+  bool                          locations = false;
+  bool                          bad       = false;
+};
+
+} // namespace ppr
@@ -3,9 +3,12 @@
 
 #include <cassert>
 #include <functional>
+#include <memory>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include <vector>
+#include "ppr_small_vector.hpp"
 
 #ifdef PPR_DYN_LIB_
 #if defined _WIN32 || defined __CYGWIN__
@@ -39,13 +42,37 @@ namespace ppr
 {
 
 #ifdef PPR_SMALL_VECTOR
-template <typename T, unsigned N>
-using vector = PPR_SMALL_VECTOR<T, N>;
+template <typename T, unsigned N, typename Allocator = std::allocator<T>>
+using vector = PPR_SMALL_VECTOR<T, N, Allocator>;
 #else
-template <typename T, unsigned N>
-using vector = std::vector<T>;
+template <typename T, unsigned N, typename Allocator = std::allocator<T>>
+using vector = ppr::small_vector<T, N, Allocator>;
 #endif
 
+template <typename T, unsigned N>
+using pmr_vector = ppr::vector<T, N, std::pmr::polymorphic_allocator<T>>;
+
+// Deletes an object made by make_pmr, with the resource it came from
+struct pmr_deleter
+{
+  std::pmr::memory_resource* resource = nullptr;
+
+  template <typename T>
+  void operator()(T* p) const
+  {
+    std::pmr::polymorphic_allocator<>(resource).delete_object(p);
+  }
+};
+
+template <typename T>
+using pmr_ptr = std::unique_ptr<T, pmr_deleter>;
+
+template <typename T, typename... Args>
+pmr_ptr<T> make_pmr(std::pmr::memory_resource* mr, Args&&... args)
+{
+  return pmr_ptr<T>(std::pmr::polymorphic_allocator<>(mr).new_object<T>(std::forward<Args>(args)...), pmr_deleter{mr});
+}
+
 struct str_equal_test : public std::equal_to<>
 {
   using is_transparent = void;
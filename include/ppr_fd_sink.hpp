@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ppr_range_sink.hpp"
+#include <cstring>
+#include <memory>
+
+namespace ppr
+{
+
+// Writes output to a file descriptor through one reusable buffer, disabled code is wrapped in /* */.
+// Ranges too large for the space left are written straight from the source with writev.
+// Errors are formatted onto err_fd. Buffered output goes out on flush(), i.e. when preprocess returns.
+class PPR_API fd_sink final : public range_sink
+{
+public:
+  fd_sink(int out_fd = 1, int err_fd = 2, std::size_t buffer_size = 64 * 1024);
+  ~fd_sink();
+
+  fd_sink(fd_sink const&)            = delete;
+  fd_sink& operator=(fd_sink const&) = delete;
+
+  // Presize the buffer for an input of `size` bytes, so a file is usually written in one call
+  void reserve(std::size_t size);
+
+  // A write to out_fd failed, further output is dropped
+  bool failed() const
+  {
+    return write_failed;
+  }
+
+  void handle_range(std::string_view text, bool disabled) override
+  {
+    if (disabled != in_disabled)
+    {
+      append(disabled ? std::string_view{"/* "} : std::string_view{"*/ "});
+      in_disabled = disabled;
+    }
+    append(text);
+  }
+
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override;
+  void flush() override;
+
+private:
+  void append(std::string_view text)
+  {
+    if (text.size() > capacity - used)
+      return spill(text);
+    std::memcpy(buffer.get() + used, text.data(), text.size());
+    used += text.size();
+  }
+
+  void spill(std::string_view text);
+  void drain();
+
+  std::unique_ptr<char[]> buffer;
+  std::size_t             capacity     = 0;
+  std::size_t             used         = 0;
+  int                     out          = 1;
+  int                     err          = 2;
+  bool                    in_disabled  = false;
+  bool                    write_failed = false;
+};
+
+} // namespace ppr
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "ppr_arena.hpp"
+#include "ppr_common.hpp"
+#include "ppr_token.hpp"
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+#include <unordered_map>
+
+namespace ppr
+{
+template <typename Sink>
+class basic_transform;
+
+// 64-bit FNV-1a of `text`, continued from `h`
+inline std::uint64_t hash_text(std::string_view text, std::uint64_t h = 0xcbf29ce484222325ull)
+{
+  for (auto c : text)
+    h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+  return h;
+}
+
+// Spreads every input bit over the whole word (splitmix64 finalizer), so fingerprints can be XORed together
+inline std::uint64_t mix_hash(std::uint64_t h)
+{
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+// Hash of a macro's name and the definition text that follows it, blanks around the text left out.
+// A function-like macro's text starts with its parameter list, as in "(a,b) a+b".
+inline std::uint64_t macro_fingerprint(std::string_view name, bool is_function, std::string_view text)
+{
+  auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+  while (!text.empty() && blank(text.front()))
+    text.remove_prefix(1);
+  while (!text.empty() && blank(text.back()))
+    text.remove_suffix(1);
+  // The kind byte also keeps the name apart from the text
+  auto h = hash_text(is_function ? std::string_view{"\1", 1} : std::string_view{"\0", 1}, hash_text(name));
+  return mix_hash(hash_text(text, h));
+}
+
+// A #define read by ppr::basic_transform, its name and text are kept in its own string arena and go with it
+struct macro_definition
+{
+  using rtoken_cache = ppr::pmr_vector<rtoken, 8>;
+
+  // Fully resolved content of an object-like macro, valid while generation matches the transform's
+  struct cached_expansion
+  {
+    cached_expansion(std::pmr::memory_resource* mr) : tokens(mr), strings(mr, 256) {}
+
+    rtoken_cache  tokens;
+    // Text of the tokens, copied from the definitions and token pastes, dropped when recorded again
+    string_arena  strings;
+    std::uint64_t generation = 0;
+  };
+
+  macro_definition(std::pmr::memory_resource* mr) : strings(mr, 64), params(mr), content(mr), expansion(mr) {}
+
+  // Name, parameters, body and token text, released with the definition on #undef or redefinition
+  string_arena                          strings;
+  ppr::pmr_vector<std::string_view, 4> params;
+  rtoken_cache                          content;
+  // Unparsed definition following the macro name, see set_lazy_defines
+  std::string_view                      body;
+  cached_expansion                      expansion;
+  // See macro_fingerprint, the environment hash is the XOR of those of every visible definition
+  std::uint64_t                         fingerprint = 0;
+  bool                                  is_function = false;
+  // An #undef hiding the definition an environment below has
+  bool                                  undefined   = false;
+};
+
+// Names view the string arena of their definition
+using macro_map = std::pmr::unordered_map<std::string_view, macro_definition, ppr::str_hash, ppr::str_equal_test>;
+
+// Macro definitions frozen out of a transform (see basic_transform::freeze). Nothing writes to an environment
+// once made, so any number of transforms, on any threads, share one without locking and keep their own
+// defines and undefs on top. It holds on to the environment it was layered on.
+class macro_environment
+{
+public:
+  macro_environment(std::shared_ptr<macro_environment const> below, std::pmr::memory_resource* mr)
+      : parent(std::move(below)), macros(mr)
+  {}
+
+  // The definition of `name`, nullptr when it is not defined or undefined
+  macro_definition const* find(std::string_view name) const
+  {
+    for (auto env = this; env; env = env->parent.get())
+    {
+      auto it = env->macros.find(name);
+      if (it != env->macros.end())
+        return it->second.undefined ? nullptr : &it->second;
+    }
+    return nullptr;
+  }
+
+  // Definitions made at this level, undefs included
+  macro_map const& definitions() const
+  {
+    return macros;
+  }
+
+  std::shared_ptr<macro_environment const> const& below() const
+  {
+    return parent;
+  }
+
+  // XOR of the fingerprints of every definition visible here, those below included
+  std::uint64_t hash() const
+  {
+    return digest;
+  }
+
+private:
+  template <typename>
+  friend class basic_transform;
+
+  std::shared_ptr<macro_environment const> parent;
+  macro_map                                macros;
+  std::uint64_t                            digest = 0;
+};
+
+} // namespace ppr
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ppr_common.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace ppr
+{
+
+// Read-only contents of a file. Files of at least map_threshold bytes are memory mapped for sequential
+// access, smaller ones, or any file that cannot be mapped, are read into memory in a single copy.
+class PPR_API mapped_source
+{
+public:
+  static constexpr std::size_t map_threshold = 16 * 1024;
+
+  mapped_source() = default;
+  explicit mapped_source(std::string const& path);
+  ~mapped_source();
+
+  mapped_source(mapped_source&& other) noexcept;
+  mapped_source& operator=(mapped_source&& other) noexcept;
+
+  mapped_source(mapped_source const&)            = delete;
+  mapped_source& operator=(mapped_source const&) = delete;
+
+  // False if the file could not be opened or read
+  explicit operator bool() const
+  {
+    return ok;
+  }
+
+  std::string_view view() const
+  {
+    return std::string_view{data, length};
+  }
+
+  std::size_t size() const
+  {
+    return length;
+  }
+
+private:
+  void release();
+
+  char const*             data   = nullptr;
+  std::size_t             length = 0;
+  std::unique_ptr<char[]> buffer;
+  bool                    mapped = false;
+  bool                    ok     = false;
+};
+
+} // namespace ppr
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ppr_sink.hpp"
+
+namespace ppr
+{
+
+// Sink receiving output as text ranges. Consecutive tokens whose whitespace and text are adjacent in the
+// source, and that agree on was_disabled, are merged into a single range, so pass-through code arrives as
+// a few large slices of the source. Text made by macro handling is handed over as soon as it is posted.
+class range_sink : public sink
+{
+public:
+  using sink::sink;
+
+  // `text` views the source, or transform storage that is only valid during the call
+  virtual void handle_range(std::string_view text, bool disabled) = 0;
+
+  void handle(token const& t, symvalue const& data) final
+  {
+    bool source = t.type != token_type::ty_rtoken && t.type != token_type::ty_raw;
+    if (data.first.data() + data.first.size() == data.second.data())
+      append(std::string_view{data.first.data(), data.first.size() + data.second.size()}, t.was_disabled, source);
+    else
+    {
+      append(data.first, t.was_disabled, source);
+      append(data.second, t.was_disabled, source);
+    }
+  }
+
+  void flush() override
+  {
+    emit();
+  }
+
+private:
+  void emit()
+  {
+    if (!pending)
+      return;
+    pending = false;
+    handle_range(std::string_view{begin, size}, last_disabled);
+  }
+
+  void append(std::string_view piece, bool disabled, bool source)
+  {
+    // An empty piece still matters when it flips was_disabled
+    if (piece.empty() && disabled == last_disabled)
+      return;
+    if (pending && disabled == last_disabled && begin + size == piece.data())
+      size += piece.size();
+    else
+    {
+      emit();
+      begin         = piece.data();
+      size          = piece.size();
+      last_disabled = disabled;
+      pending       = true;
+    }
+    if (!source)
+      emit();
+  }
+
+  char const* begin         = nullptr;
+  std::size_t size          = 0;
+  bool        pending       = false;
+  bool        last_disabled = false;
+};
+
+} // namespace ppr
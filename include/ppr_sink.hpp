@@ -1,34 +1,121 @@
 #pragma once
 #include "ppr_token.hpp"
+#include <concepts>
 
 namespace ppr
 {
-class transform;
-class PPR_API sink
+template <typename Sink>
+class basic_transform;
+
+// Newline and comment filtering applied before a token reaches handle(). A sink type deriving from this,
+// rather than ppr::sink, lets ppr::basic_transform call its handle() directly instead of through a vtable.
+class basic_sink
 {
 public:
   using symvalue = std::pair<std::string_view, std::string_view>;
 
-  sink(int max_consequitive_empty_lines = 1, bool ignore_all_comments = true)
+  basic_sink(int max_consequitive_empty_lines = 1, bool ignore_all_comments = true)
       : max_consequtive_newlines(max_consequitive_empty_lines), ignore_comments(ignore_all_comments)
   {}
 
-  virtual void error(std::string_view, std::string_view, ppr::token, ppr::loc) = 0;
-  virtual void handle(token const& t, symvalue const& data)                    = 0;
-
   void set_ignore_comments(bool i)
   {
     ignore_comments = i;
   }
 
+  bool ignores_comments() const
+  {
+    return ignore_comments;
+  }
+
 private:
-  friend class transform;
-  void filter(token const& t, transform const&);
+  template <typename>
+  friend class basic_transform;
+
+  // False when the token must not be handed to the sink, `type` is resolved through rtokens
+  bool accept(token const& t, token_type type)
+  {
+    switch (type)
+    {
+    case token_type::ty_eof:
+      break;
+    case token_type::ty_sl_comment:
+      [[fallthrough]];
+    case token_type::ty_blk_comment:
+      if (ignore_comments)
+        return false;
+      last = t.type;
+      return true;
+    default:
+      last = t.type;
+      return true;
+    case token_type::ty_newline:
+    {
+      bool allow = true;
+      if (max_consequtive_newlines > 0)
+      {
+        if (last != token_type::ty_newline)
+          consequtive_newlines = 1;
+        else if (consequtive_newlines++ > max_consequtive_newlines)
+          allow = false;
+      }
+      last = t.type;
+      return allow;
+    }
+    }
+    last = t.type;
+    return false;
+  }
+
+private:
+  token_type last                     = token_type::ty_eof;
+  int        consequtive_newlines     = 0;
+  int        max_consequtive_newlines = -1;
+  bool       ignore_comments          = true;
+};
+
+class PPR_API sink : public basic_sink
+{
+public:
+  using basic_sink::basic_sink;
+
+  virtual void error(std::string_view, std::string_view, ppr::token, ppr::loc) = 0;
+  virtual void handle(token const& t, symvalue const& data)                    = 0;
+  // Called before preprocess returns, token and text views of the source are still valid
+  virtual void flush() {}
+};
+
+// Requirements on the sink type of ppr::basic_transform
+template <typename S>
+concept sink_type = std::derived_from<S, basic_sink> &&
+                    requires(S& s, token const& t, basic_sink::symvalue const& data, std::string_view sv, loc l) {
+                      s.handle(t, data);
+                      s.error(sv, sv, t, l);
+                    };
+
+// Virtual view of a statically dispatched sink, given to the tokenizer and to transform's internal sinks
+template <typename Sink>
+class sink_relay final : public sink
+{
+public:
+  sink_relay(Sink* s) : target(s) {}
+
+  void reset(Sink* s)
+  {
+    target = s;
+  }
+
+  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  {
+    target->error(s, e, t, l);
+  }
+
+  void handle(token const& t, symvalue const& data) override
+  {
+    target->handle(t, data);
+  }
 
 private:
-  token last;
-  int   consequtive_newlines     = 0;
-  int   max_consequtive_newlines = -1;
-  bool  ignore_comments          = true;
+  Sink* target;
 };
-} // namespace ppr
\ No newline at end of file
+} // namespace ppr
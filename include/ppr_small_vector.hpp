@@ -0,0 +1,365 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace ppr
+{
+
+// Vector that keeps up to N elements inline before spilling to memory from Allocator.
+// Elements are only ever constructed and destroyed, never assigned, so types with
+// reference members (like transform's token stream sources) are supported.
+// The allocator is not propagated to nested containers.
+template <typename T, unsigned N, typename Allocator = std::allocator<T>>
+class small_vector
+{
+  using alloc_traits = std::allocator_traits<Allocator>;
+
+  static_assert(N > 0, "ppr::small_vector needs room for at least one inline element");
+
+  // Moving takes the other's memory, without allocating, when the allocators are sure to compare equal
+  static constexpr bool nothrow_move_assign = std::is_nothrow_move_constructible_v<T> &&
+                                              (alloc_traits::propagate_on_container_move_assignment::value ||
+                                               alloc_traits::is_always_equal::value);
+
+public:
+  using allocator_type  = Allocator;
+  using value_type      = T;
+  using size_type       = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference       = T&;
+  using const_reference = T const&;
+  using pointer         = T*;
+  using const_pointer   = T const*;
+  using iterator        = T*;
+  using const_iterator  = T const*;
+
+  small_vector() noexcept(noexcept(Allocator())) : ptr(inline_data()) {}
+
+  explicit small_vector(Allocator const& a) noexcept : ptr(inline_data()), alloc(a) {}
+
+  small_vector(small_vector const& other)
+      : ptr(inline_data()), alloc(alloc_traits::select_on_container_copy_construction(other.alloc))
+  {
+    reserve(other.count);
+    std::uninitialized_copy(other.begin(), other.end(), ptr);
+    count = other.count;
+  }
+
+  small_vector(small_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+      : ptr(inline_data()), alloc(std::move(other.alloc))
+  {
+    take(std::move(other));
+  }
+
+  small_vector(small_vector const& other, Allocator const& a) : ptr(inline_data()), alloc(a)
+  {
+    reserve(other.count);
+    std::uninitialized_copy(other.begin(), other.end(), ptr);
+    count = other.count;
+  }
+
+  small_vector(small_vector&& other, Allocator const& a) : ptr(inline_data()), alloc(a)
+  {
+    if (alloc == other.alloc)
+      take(std::move(other));
+    else
+    {
+      reserve(other.count);
+      relocate(other.ptr, other.count, ptr);
+      count       = other.count;
+      other.count = 0;
+    }
+  }
+
+  small_vector& operator=(small_vector const& other)
+  {
+    if (this != &other)
+    {
+      clear();
+      reserve(other.count);
+      std::uninitialized_copy(other.begin(), other.end(), ptr);
+      count = other.count;
+    }
+    return *this;
+  }
+
+  small_vector& operator=(small_vector&& other) noexcept(nothrow_move_assign)
+  {
+    if (this != &other)
+    {
+      clear();
+      if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+      {
+        release();
+        alloc = std::move(other.alloc);
+        take(std::move(other));
+      }
+      else if (alloc == other.alloc)
+      {
+        release();
+        take(std::move(other));
+      }
+      else
+      {
+        // memory cannot be handed over between unequal allocators
+        reserve(other.count);
+        relocate(other.ptr, other.count, ptr);
+        count       = other.count;
+        other.count = 0;
+      }
+    }
+    return *this;
+  }
+
+  ~small_vector()
+  {
+    clear();
+    release();
+  }
+
+  iterator begin() noexcept
+  {
+    return ptr;
+  }
+  iterator end() noexcept
+  {
+    return ptr + count;
+  }
+  const_iterator begin() const noexcept
+  {
+    return ptr;
+  }
+  const_iterator end() const noexcept
+  {
+    return ptr + count;
+  }
+
+  T* data() noexcept
+  {
+    return ptr;
+  }
+  T const* data() const noexcept
+  {
+    return ptr;
+  }
+
+  size_type size() const noexcept
+  {
+    return count;
+  }
+  size_type capacity() const noexcept
+  {
+    return cap;
+  }
+  bool empty() const noexcept
+  {
+    return count == 0;
+  }
+
+  T& operator[](size_type i) noexcept
+  {
+    return ptr[i];
+  }
+  T const& operator[](size_type i) const noexcept
+  {
+    return ptr[i];
+  }
+
+  T& at(size_type i)
+  {
+    if (i >= count)
+      throw std::out_of_range("ppr::small_vector::at");
+    return ptr[i];
+  }
+  T const& at(size_type i) const
+  {
+    if (i >= count)
+      throw std::out_of_range("ppr::small_vector::at");
+    return ptr[i];
+  }
+
+  T& front() noexcept
+  {
+    return ptr[0];
+  }
+  T const& front() const noexcept
+  {
+    return ptr[0];
+  }
+  T& back() noexcept
+  {
+    return ptr[count - 1];
+  }
+  T const& back() const noexcept
+  {
+    return ptr[count - 1];
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args)
+  {
+    if (count == cap)
+      return emplace_back_grow(std::forward<Args>(args)...);
+    auto p = ::new (static_cast<void*>(ptr + count)) T(std::forward<Args>(args)...);
+    count++;
+    return *p;
+  }
+
+  void push_back(T const& v)
+  {
+    emplace_back(v);
+  }
+
+  void push_back(T&& v)
+  {
+    emplace_back(std::move(v));
+  }
+
+  void pop_back() noexcept
+  {
+    std::destroy_at(ptr + --count);
+  }
+
+  void clear() noexcept
+  {
+    std::destroy(ptr, ptr + count);
+    count = 0;
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return alloc;
+  }
+
+  void reserve(size_type n)
+  {
+    if (n > cap)
+      reallocate(n);
+  }
+
+  void shrink_to_fit()
+  {
+    if (is_inline() || count == cap)
+      return;
+    if (count <= N)
+    {
+      T* heap = ptr;
+      ptr     = inline_data();
+      relocate(heap, count, ptr);
+      deallocate(heap, cap);
+      cap = N;
+    }
+    else
+      reallocate(count);
+  }
+
+private:
+  bool is_inline() const noexcept
+  {
+    return ptr == inline_data();
+  }
+
+  T* inline_data() noexcept
+  {
+    return std::launder(reinterpret_cast<T*>(storage));
+  }
+  T const* inline_data() const noexcept
+  {
+    return std::launder(reinterpret_cast<T const*>(storage));
+  }
+
+  T* allocate(size_type n)
+  {
+    return alloc_traits::allocate(alloc, n);
+  }
+
+  void deallocate(T* p, size_type n)
+  {
+    alloc_traits::deallocate(alloc, p, n);
+  }
+
+  static void relocate(T* from, size_type n, T* to)
+  {
+    if constexpr (std::is_nothrow_move_constructible_v<T>)
+      std::uninitialized_move(from, from + n, to);
+    else
+      std::uninitialized_copy(from, from + n, to);
+    std::destroy(from, from + n);
+  }
+
+  void release() noexcept
+  {
+    if (!is_inline())
+      deallocate(ptr, cap);
+    ptr = inline_data();
+    cap = N;
+  }
+
+  void reallocate(size_type n)
+  {
+    T* mem = allocate(n);
+    relocate(ptr, count, mem);
+    if (!is_inline())
+      deallocate(ptr, cap);
+    ptr = mem;
+    cap = n;
+  }
+
+  // Construct the new element before moving the old ones, args may refer into this vector
+  template <typename... Args>
+  T& emplace_back_grow(Args&&... args)
+  {
+    auto n   = cap ? cap * 2 : 1;
+    T*   mem = allocate(n);
+    T*   p   = nullptr;
+    try
+    {
+      p = ::new (static_cast<void*>(mem + count)) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      deallocate(mem, n);
+      throw;
+    }
+    relocate(ptr, count, mem);
+    if (!is_inline())
+      deallocate(ptr, cap);
+    ptr = mem;
+    cap = n;
+    count++;
+    return *p;
+  }
+
+  // Expects this to be empty, and inline unless other is inline too
+  void take(small_vector&& other)
+  {
+    if (other.is_inline())
+    {
+      relocate(other.ptr, other.count, ptr);
+      count       = other.count;
+      other.count = 0;
+    }
+    else
+    {
+      ptr         = other.ptr;
+      cap         = other.cap;
+      count       = other.count;
+      other.ptr   = other.inline_data();
+      other.cap   = N;
+      other.count = 0;
+    }
+  }
+
+  T*                              ptr   = nullptr;
+  size_type                       count = 0;
+  size_type                       cap   = N;
+  [[no_unique_address]] Allocator alloc;
+  alignas(T) unsigned char        storage[sizeof(T) * N];
+};
+
+} // namespace ppr
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ppr_common.hpp"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ppr
+{
+
+// Maps output byte offsets back to the input, built by ppr::basic_transform while it posts tokens
+// (see set_source_map). Output offsets count the whitespace and text handed to the sink.
+//
+// The table is a list of segments, each one starting where the previous ends. A segment of pass-through
+// code maps its bytes one to one onto the source, a macro expansion maps all of its bytes onto the call
+// site. Segments are LEB128 varints:
+//   head      output offset delta << 3 | flags (1: expanded, 2: pass-through, 4: next source)
+//   source    zigzag delta of the source offset, relative to 0 on a new source
+//   line      zigzag delta of the line, relative to 0 on a new source
+//   macro     for expanded segments, the macro name index, a new index is followed by the name
+class PPR_API source_map
+{
+public:
+  static constexpr std::uint8_t expanded    = 1;
+  static constexpr std::uint8_t passthrough = 2;
+  static constexpr std::uint8_t next_source = 4;
+
+  struct location
+  {
+    // Index of the preprocess call the output came from
+    std::uint32_t    source = 0;
+    std::int32_t     offset = 0;
+    std::int32_t     line   = 0;
+    // The outermost macro expanded at offset, empty for code that is not a macro expansion
+    std::string_view macro;
+  };
+
+  // Output text of `length` bytes copied from the source at `offset`
+  void add_source(std::size_t length, std::int32_t offset, std::int32_t line);
+  // Output text of `length` bytes expanded from `macro`, called at `offset`
+  void add_expanded(std::size_t length, std::string_view macro, std::int32_t offset, std::int32_t line);
+  // Output text without a source position (disabled code records), mapped to the last position
+  void add_opaque(std::size_t length);
+  // Output that continues the current segment
+  void extend(std::size_t length)
+  {
+    out += length;
+  }
+  // Offsets that follow refer to the source of a new preprocess call
+  void begin_source();
+
+  // Location of the output byte at `offset`, false past the mapped output
+  bool find(std::size_t offset, location& l) const;
+
+  std::span<std::uint8_t const> data() const
+  {
+    return table;
+  }
+
+  std::size_t output_size() const
+  {
+    return out;
+  }
+
+  void clear();
+
+private:
+  void put(std::uint64_t v);
+  void put_segment(std::uint8_t flags, std::int32_t offset, std::int32_t line, std::uint32_t name = 0);
+
+  using name_map = std::unordered_map<std::string, std::uint32_t, ppr::str_hash, ppr::str_equal_test>;
+
+  std::vector<std::uint8_t> table;
+  std::vector<std::string>  names;
+  name_map                  name_index;
+  std::size_t               out           = 0;
+  // Names already written to the table
+  std::uint32_t             written_names = 0;
+
+  // Last segment written
+  std::size_t   seg_out    = 0;
+  std::int32_t  seg_offset = 0;
+  std::int32_t  seg_line   = 0;
+  std::uint32_t seg_name   = 0;
+  std::uint8_t  seg_flags  = 0;
+  bool          segments   = false;
+  bool          new_source = false;
+};
+
+} // namespace ppr
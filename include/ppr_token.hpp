@@ -29,6 +29,8 @@ enum class token_type : std::int32_t
   ty_keyword_ident,
   ty_raw,
   ty_rtoken,
+  // Verbatim span of the source, see basic_transform::set_disabled_ranges
+  ty_source_range,
   ty_eof = -1,
 };
 
@@ -68,10 +70,12 @@ enum class operator2_type : std::uint8_t
   op_tokpaste
 };
 
+// Token produced by macro handling. The whitespace and text are viewed from the source being
+// processed or from storage owned by the transform.
 struct rtoken
 {
-  int         replace = -1;
-  std::string value;
+  int              replace = -1;
+  std::string_view value;
   std::int16_t whitespaces = 0;
   union
   {
@@ -96,12 +100,12 @@ struct rtoken
 
   std::string_view sspace() const
   {
-    return std::string_view{value.c_str(), static_cast<std::size_t>(whitespaces)};
+    return std::string_view{value.data(), static_cast<std::size_t>(whitespaces)};
   }
 
   std::string_view svalue() const
   {
-    return std::string_view{value.c_str() + whitespaces, value.length() - whitespaces};
+    return std::string_view{value.data() + whitespaces, value.length() - whitespaces};
   }
 
   auto op_type() const
@@ -137,11 +141,11 @@ struct token
   {
     token_data td;
     rtoken_ptr rt;
-    std::string const* raw;
+    std::string_view const* raw;
 
     content() : td{} {}
     content(rtoken_ptr v) : rt{v} {}
-    content(std::string const& r) : raw(&r) {}
+    content(std::string_view const& r) : raw(&r) {}
   };
 
 #ifndef NDEBUG
@@ -154,7 +158,9 @@ struct token
   token() = default;
   token(bool b) : type(b ? token_type::ty_true : token_type::ty_false) {}
   token(rtoken const& rt) : type(token_type::ty_rtoken), value(&rt) {}
-  token(std::string const& r) : type(token_type::ty_raw), value(r) {}
+  // Views `r` itself, which must outlive the token
+  token(std::string_view const& r) : type(token_type::ty_raw), value(r) {}
+  token(std::string_view&&) = delete;
     
   auto op_type() const
   {
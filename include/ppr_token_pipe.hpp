@@ -0,0 +1,109 @@
+#pragma once
+
+#include "ppr_common.hpp"
+#include "ppr_token.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ppr
+{
+class sink;
+
+// Tokenizes a source on its own thread, ahead of the reader. Tokens are handed over through a
+// single-producer, single-consumer ring, published in batches so the two threads rarely touch the same
+// cache lines. Errors the tokenizer reports are replayed to the reader's sink, before the token that
+// followed them. A tokenizer reads from the pipe once attached to it (see tokenizer::attach).
+//
+// With more than one thread, the source is split at newlines into chunks that worker threads tokenize
+// concurrently, each starting as if at the beginning of a file. The producer joins them in order. Where a
+// chunk did not start in that state (it starts inside a comment or a string), tokens are taken from the
+// first newline both scans agree on, and a chunk that never agrees is tokenized again.
+class PPR_API token_pipe
+{
+public:
+  // `chunk_size` of 0 picks one from the source size and thread count. `capacity` is rounded up to a power
+  // of two. Scanners allocate with new/delete, a memory resource given to the reader's side need not be
+  // thread safe.
+  token_pipe(std::string_view source, bool elide_comments, unsigned threads = 1, std::size_t chunk_size = 0,
+             std::size_t capacity = 16 * 1024);
+  ~token_pipe();
+
+  token_pipe(token_pipe const&)            = delete;
+  token_pipe& operator=(token_pipe const&) = delete;
+
+  // Next token, ty_eof past the end of the source
+  token next(sink& errors);
+  // Drops the tokens that start before `offset`, and the errors reported on them
+  void  skip_to(std::int32_t offset);
+
+private:
+  struct error_record
+  {
+    // Tokens produced before the error
+    std::size_t index;
+    std::string message;
+    std::string what;
+    loc         location;
+  };
+  class error_log;
+  struct chunk;
+
+  void produce();
+  // Adds a token to the ring, false when the reader is gone
+  bool push(token const& t);
+  void publish();
+  void record_error(error_record e);
+
+  // Tokens of the source from `from` up to the first newline that ends at or past `to`
+  void scan_chunk(chunk& c, std::int32_t from, std::int32_t to);
+  void work();
+  void join_chunks();
+
+  // Waits for tokens past `read`
+  void wait_for_tokens();
+  // Hands slots back to the producer a batch at a time
+  void consumed();
+  void deliver_errors(sink& to);
+
+  std::string_view source;
+  bool             elide_comments;
+
+  std::unique_ptr<token[]> ring;
+  std::size_t              mask;
+
+  // Written by the producer
+  alignas(64) std::atomic<std::size_t> tail{0};
+  std::size_t                          write = 0;
+  std::size_t                          limit = 0;
+  // Written by the consumer
+  alignas(64) std::atomic<std::size_t> head{0};
+  std::atomic<bool>                    stop{false};
+
+  // Consumer side
+  alignas(64) std::size_t read      = 0;
+  std::size_t             available = 0;
+  std::size_t             delivered = 0;
+  bool                    finished  = false;
+  token                   end_token;
+
+  std::mutex                errors_lock;
+  std::vector<error_record> errors;
+  std::atomic<std::size_t>  error_count{0};
+
+  // Chunked scanning, workers claim chunks in order and stay at most `window` chunks ahead of the join
+  std::vector<std::unique_ptr<chunk>> chunks;
+  std::atomic<std::size_t>            next_chunk{0};
+  std::atomic<std::size_t>            joined{0};
+  std::size_t                         window = 0;
+  std::vector<std::thread>            workers;
+
+  std::thread producer;
+};
+
+} // namespace ppr
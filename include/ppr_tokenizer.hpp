@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <functional>
 #include <limits>
+#include <memory_resource>
 #include <string>
 #include <cstring>
 #include <string_view>
@@ -15,10 +16,13 @@
 namespace ppr
 {
 class sink;
+class token_pipe;
 class PPR_API tokenizer
 {
 public:
-  tokenizer(std::string_view ss, sink& r) : reporter(r), content(ss)
+  // The flex scanner's buffers are allocated from mr
+  tokenizer(std::string_view ss, sink& r, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+      : reporter(&r), content(ss), resource(mr)
   {
     begin_scan();
   }
@@ -137,6 +141,25 @@ public:
     pos_commit += len;
   }
 
+  // Comments are consumed like whitespace, without producing tokens
+  inline void set_elide_comments(bool value)
+  {
+    elide_all_comments = value;
+  }
+
+  inline bool elide_comments() const
+  {
+    return elide_all_comments;
+  }
+
+  inline void elide(int len)
+  {
+    pos_commit += len;
+    whitespaces = 0;
+  }
+
+  void unmatched(int len);
+
   int read(char* data, int size)
   {
     auto min = std::min<std::int32_t>(static_cast<std::int32_t>(content.size() - pos), size);
@@ -207,6 +230,35 @@ public:
   void begin_scan();
   void end_scan();
 
+  // Scan another source from its start, keeping the flex scanner and its buffers. Errors go to `r` from then on.
+  void reset(std::string_view source);
+  void reset(std::string_view source, sink& r)
+  {
+    reporter = &r;
+    reset(source);
+  }
+
+  std::pmr::memory_resource* get_memory_resource() const
+  {
+    return resource;
+  }
+
+  // Resume scanning at a line start in the source, discarding buffered input
+  void skip_to(std::int32_t offset, int line_count);
+
+  // Read tokens from a pipe scanning the same source on another thread, instead of scanning here
+  void attach(token_pipe* p)
+  {
+    pipe = p;
+  }
+
+  // Called on "/*": finds the comment end in the source and moves the scanner past it. Returns the comment
+  // length, 0 if it is not terminated.
+  std::int32_t scan_block_comment();
+  // Called on the first digit of a line marker after '#': moves the scanner to the end of the line. Returns
+  // the length skipped.
+  std::int32_t skip_line_marker();
+
   void print_tokens();
 
   token get();
@@ -228,18 +280,23 @@ public:
   token peek();
 
 private:
-  sink& reporter;
+  void jump(std::int32_t from, std::int32_t to);
+
+  sink* reporter;
   loc   location;
   int   whitespaces = 0;
   token lookahead;
 
   std::string_view content;
-  std::int32_t     pos         = 0;
-  std::int32_t     pos_commit  = 0;
-  std::int32_t     len_reading = 0;
-  bool             ahead       = false;
-
-  void* token_scanner = nullptr;
+  std::int32_t     pos                = 0;
+  std::int32_t     pos_commit         = 0;
+  std::int32_t     len_reading        = 0;
+  bool             ahead              = false;
+  bool             elide_all_comments = false;
+
+  void*                      token_scanner = nullptr;
+  std::pmr::memory_resource* resource      = nullptr;
+  token_pipe*                pipe          = nullptr;
 };
 
 } // namespace ppr
\ No newline at end of file
@@ -2,31 +2,205 @@
 
 #pragma once
 
+#include "ppr_arena.hpp"
 #include "ppr_common.hpp"
 #include "ppr_eval_type.hpp"
+#include "ppr_macro_environment.hpp"
+#include "ppr_mapped_source.hpp"
 #include "ppr_sink.hpp"
+#include "ppr_source_map.hpp"
+#include "ppr_token_pipe.hpp"
 #include "ppr_tokenizer.hpp"
+#include <iterator>
 #include <list>
+#include <memory>
+#include <optional>
+#include <span>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ppr
 {
 
-struct live_eval;
-class PPR_API transform
+// State of an #if evaluation, tokens of the expression are resolved on demand
+struct live_eval : public sink
 {
+  enum class finish_state : std::uint8_t
+  {
+    none,
+    end_of_seq,
+    result_available
+  };
+
+  std::uint32_t                             i = 0;
+  ppr::pmr_vector<std::pair<rtoken, loc>, 2> saved;
+
+#ifndef PPR_DISABLE_RECORD
+  std::pmr::string record;
+  bool             record_content = false;
+#endif
+
+  std::pair<rtoken, loc> empty;
+  sink&                  chain;
+
+  eval_type    result   = {};
+  finish_state finished = finish_state::none;
+
+  live_eval(sink& cchain, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+      : saved(mr),
+#ifndef PPR_DISABLE_RECORD
+        record(mr),
+#endif
+        chain(cchain)
+  {}
+
+  // Parses the #if expression, defined in ppr_eval.yy
+  eval_type evaluate();
+
+  // Resolves the next token of the expression into saved
+  virtual void   resolve_next()           = 0;
+  virtual rtoken from(token const&)       = 0;
+  virtual bool   error_bit() const        = 0;
+
+  void reset()
+  {
+    result   = false;
+    finished = finish_state::none;
+    saved.clear();
+#ifndef PPR_DISABLE_RECORD
+    record.clear();
+#endif
+    i = 0;
+  }
+  auto const& get()
+  {
+    while (true)
+    {      
+      if (i >= static_cast<std::uint32_t>(saved.size()))
+      {
+        i = 0;
+        saved.clear();
+        resolve_next();
+        if (saved.empty())
+          break;
+      }
+      if (i < static_cast<std::uint32_t>(saved.size()))
+      {
+        auto& ret = saved[i++];
+        return ret;
+      }
+    }
+
+    return empty;
+  }
+
+  std::string_view value(rtoken const& t)
+  {
+    return t.svalue();
+  }
+
+  void set_result(eval_type val)
+  {
+    result   = val;
+    finished = finish_state::result_available;
+  }
+
+  bool has_result() const
+  {
+    return finished == finish_state::result_available;
+  }
+
+  void handle(token const& t, symvalue const& data) override
+  {
+#ifndef PPR_DISABLE_RECORD
+    if (record_content)
+    {
+      record += data.first;
+      record += data.second;
+    }
+#endif
+
+    if (t.was_disabled)
+      return;
+
+    if (finished != finish_state::none)
+      return;
+    if (t.type == ppr::token_type::ty_eof)
+    {
+      finished = finish_state::end_of_seq;
+      return;
+    }
+    auto ty = from(t);
+    if (ty.type == ppr::token_type::ty_eof)
+    {
+      finished = finish_state::end_of_seq;
+      return;
+    }
+    if (ty.type != token_type::ty_newline)
+      saved.emplace_back(std::move(ty), (t.type != token_type::ty_rtoken) ? t.value.td.pos : loc{});
+    else
+      finished = finish_state::end_of_seq;
+  }
+  void push_error(std::string_view err, std::string_view tok, loc pos)
+  {
+    chain.error(err, tok, ppr::token(), pos);
+  }
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override {}
+};
+
+// A token pulled from basic_transform::tokens, with the whitespace and text a sink would be handed
+struct output_token
+{
+  token            tok;
+  std::string_view space;
+  std::string_view text;
+};
+
+// What basic_transform::reset does with the macro definitions
+enum class reset_mode : std::uint8_t
+{
+  keep_macros,
+  clear_macros
+};
+
+// Runs the preprocessor over sources, handing the resulting tokens to a Sink. The handler and the sink's
+// filtering are called directly for the concrete Sink type, ppr::transform dispatches through ppr::sink.
+// Definitions are in ppr_transform_impl.hpp, ppr::transform is instantiated by the library.
+template <typename Sink>
+class basic_transform
+{
+  static_assert(sink_type<Sink>, "Sink must derive from ppr::basic_sink and provide handle/error");
+
 public:
-  using token_cache        = ppr::vector<token, 8>;
-  using rtoken_cache       = ppr::vector<rtoken, 8>;
-  using param_substitution = ppr::vector<token_cache, 4>;
+  using token_cache        = ppr::pmr_vector<token, 8>;
+  using rtoken_cache       = ppr::pmr_vector<rtoken, 8>;
+  using param_substitution = ppr::pmr_vector<token_cache, 4>;
 
-  friend class sink;
-  friend struct live_eval;
+  struct cache_stats
+  {
+    std::uint64_t hits   = 0;
+    std::uint64_t misses = 0;
+    std::size_t   bytes  = 0;
+  };
 
-  transform() : last_sink(nullptr) {}
-  transform(sink& s) : last_sink(&s) {}
+  // Macro storage, caches, expansion temporaries, pooled tokenizers and pulled token ranges allocate from mr.
+  // The generated #if parser keeps its stack on the heap.
+  basic_transform(std::pmr::memory_resource* mr = std::pmr::get_default_resource()) : basic_transform(nullptr, mr) {}
+  basic_transform(Sink& s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) : basic_transform(&s, mr)
+  {}
 
   void preprocess(std::string_view sources);
+  // Preprocesses a file through ppr::mapped_source, an unreadable file is reported as an error
+  void preprocess_file(std::string const& path);
+
+  class token_range;
+  // Preprocesses `source` as the returned input range is iterated, instead of posting to the sink. Tokens are
+  // filtered like a default ppr::sink does; minify, disabled ranges and the source map do not apply. Errors
+  // still go to the sink. Stopping early skips the rest of the source, definitions read so far are kept.
+  // The source must outlive the range and the transform must not be used for anything else meanwhile.
+  token_range tokens(std::string_view source);
 
   bool          eval_bool(std::string_view sources);
   std::uint64_t eval_uint(std::string_view sources);
@@ -41,6 +215,95 @@ public:
     ignore_disabled = ig;
   }
 
+  // Drop comments in the tokenizer and emit only the whitespace needed to keep tokens apart. Newlines are
+  // kept where a directive line ends.
+  void set_minify(bool m)
+  {
+    minify = m;
+  }
+
+  // With disabled code printed, hand every run of disabled tokens to the sink as a single ty_source_range
+  // token spanning the source text, #if lines and comments included
+  void set_disabled_ranges(bool dr)
+  {
+    disabled_ranges = dr;
+  }
+
+  // Record where the output comes from while tokens are posted, nullptr (default) stops recording
+  void set_source_map(source_map* m)
+  {
+    map = m;
+  }
+
+  // When macro usage is transformed, store #define bodies as text and parse them on first use
+  void set_lazy_defines(bool ld)
+  {
+    lazy_defines = ld;
+  }
+
+  // Tokenize sources of at least `bytes` on a separate thread, ahead of macro and directive handling. 0
+  // (default) keeps tokenizing on the calling thread.
+  void set_pipeline_threshold(std::size_t bytes)
+  {
+    pipeline_threshold = bytes;
+  }
+
+  // With the pipeline on, split sources at newlines into chunks tokenized by `threads` threads at once
+  void set_tokenizer_threads(unsigned threads)
+  {
+    tokenizer_threads = threads;
+  }
+
+  // Defines an object-like macro as #define name value would, straight into the macro table. False when
+  // `name` is not an identifier or is already defined, the first definition stays.
+  bool        define(std::string_view name, std::string_view value = {});
+  bool        define_function(std::string_view name, std::span<std::string_view const> params, std::string_view body);
+  // Defines each (name, value) pair, returns how many were added
+  std::size_t define_all(std::span<std::pair<std::string_view, std::string_view> const> definitions);
+  // As #undef name, false when `name` was not defined
+  bool        undefine(std::string_view name);
+
+  // XOR of the fingerprints of every visible definition, shared ones included, kept up to date by each define
+  // and undef. Transforms holding the same definitions have the same hash, whatever order they came in.
+  std::uint64_t environment_hash() const
+  {
+    return env_hash;
+  }
+
+  // ppr::macro_fingerprint of the visible definition of `name`, 0 when it is not defined
+  std::uint64_t fingerprint(std::string_view name) const
+  {
+    auto m = find_macro(name);
+    return m ? m->fingerprint : 0;
+  }
+
+  // Starts over for an unrelated source: clears the error bit and the #if and output state, and with
+  // clear_macros the local definitions and every cached expansion. Options, the shared environment and the
+  // allocated buckets, arenas and tokenizers are kept.
+  void reset(reset_mode mode = reset_mode::clear_macros);
+
+  // Moves the definitions made so far into a frozen ppr::macro_environment, layered on the current one, and
+  // carries on with it below an empty set of local definitions. Lazy bodies are parsed first. The memory
+  // resource must outlive the environment, and be safe to release from the thread dropping the last reference.
+  std::shared_ptr<macro_environment const> freeze();
+
+  // Use definitions shared with other transforms, local defines and undefs stay on top of them
+  void set_environment(std::shared_ptr<macro_environment const> env);
+
+  // Memoize function-like macro calls by their argument tokens, 0 (default) disables the cache. The entries
+  // share one arena, so the whole cache is dropped when an expansion would take it past `bytes`.
+  void set_call_cache_limit(std::size_t bytes)
+  {
+    call_cache_limit = bytes;
+    if (call_cache_stats.bytes > call_cache_limit)
+      clear_call_cache();
+  }
+
+  cache_stats const& get_call_cache_stats() const
+  {
+    return call_cache_stats;
+  }
+
   void push_error(std::string_view s, token const& t);
   void push_error(std::string_view s, std::string_view t, loc const& l);
 
@@ -49,16 +312,24 @@ public:
     return err_bit;
   }
 
-  sink* exchange(sink* newsink)
+  Sink* exchange(Sink* newsink)
   {
-    sink* save = last_sink;
-    last_sink  = newsink;
-    return save;
+    relay.reset(newsink);
+    return std::exchange(out, newsink);
+  }
+
+  std::pmr::memory_resource* get_memory_resource() const
+  {
+    return scratch.resource();
   }
 
 private:
-  void token_paste(rtoken& rt, token const& t);
-  void token_paste(rtoken& rt, rtoken const& t);
+  basic_transform(Sink* s, std::pmr::memory_resource* mr)
+      : out(s), relay(s), scratch(mr), macros(mr), scanners(mr), shared_expansions(mr), calls(mr), call_strings(mr)
+  {}
+
+  void token_paste(rtoken& rt, token const& t, string_arena& to);
+  void token_paste(rtoken& rt, rtoken const& t, string_arena& to);
 
   struct rtoken_generator;
 
@@ -79,6 +350,12 @@ private:
 
   rtoken from(token const&);
 
+  // Keep a view alive past the current source, returns it unchanged when already in `to`
+  std::string_view retain(std::string_view sv, string_arena& to)
+  {
+    return (sv.empty() || to.owns(sv.data())) ? sv : to.store(sv);
+  }
+
   inline std::string_view value(rtoken const& t) const
   {
     return t.svalue();
@@ -114,7 +391,7 @@ private:
 
   bool is_defined(std::string_view name) const
   {
-    return (macros.find(name) != macros.end());
+    return find_macro(name) != nullptr;
   }
 
   static inline token get(tokenizer& tk)
@@ -125,12 +402,56 @@ private:
   inline void post(token t)
   {
     t.was_disabled = section_disabled;
-    last_sink->filter(t, *this);
+    post_const(t);
   }
 
+  // Internal sinks (#if evaluation, expansion recording) take over through `redirect`
   inline void post_const(token const& t)
   {
-    last_sink->filter(t, *this);
+    if (redirect)
+      deliver(*redirect, t);
+    else if (!disabled_ranges || !gather_disabled(t))
+      deliver_out(t);
+  }
+
+  inline void deliver_out(token const& t)
+  {
+    if (minify)
+      deliver_minified(t);
+    else if (map)
+      deliver_mapped(t);
+    else
+      deliver(*out, t);
+  }
+
+  bool gather_disabled(token const& t);
+  void flush_disabled();
+  void deliver_minified(token const& t);
+  void deliver_mapped(token const& t);
+  void map_output(token const& t, std::size_t space, std::size_t length);
+
+  template <typename S>
+  inline void deliver(S& s, token const& t)
+  {
+    if (s.accept(t, type(t)))
+      s.handle(t, wspace_content_pair(t));
+  }
+
+  // Comments the output would discard are not turned into tokens
+  bool elide_comments() const
+  {
+    return minify || !out || out->ignores_comments();
+  }
+
+  // Where errors and tokens currently go, as a ppr::sink
+  sink& current()
+  {
+    if (redirect)
+      return *redirect;
+    if constexpr (std::is_base_of_v<sink, Sink>)
+      return *out;
+    else
+      return relay;
   }
 
   inline std::string_view content_value(std::int32_t start, std::int32_t length) const
@@ -153,28 +474,41 @@ private:
     }
   }
 
-  struct macro
+  using macro    = macro_definition;
+  using macromap = macro_map;
+
+  // Local definition first, then the shared environment
+  macro const* find_macro(std::string_view name) const
   {
-    using rtoken = ppr::rtoken;
-    ppr::vector<std::string, 4> params;
-    rtoken_cache                content;
-    bool                        is_function = false;
-  };
+    auto it = macros.find(name);
+    if (it != macros.end())
+      return it->second.undefined ? nullptr : &it->second;
+    return environment ? environment->find(name) : nullptr;
+  }
 
-  using macromap = std::unordered_map<std::string, macro, ppr::str_hash, ppr::str_equal_test>;
+  bool add_macro(std::string_view name, macro&& m);
 
-  void        read_macro_fn(token start, tokenizer&, macro&);
-  void        read_macro_def(token start, tokenizer&, macro&);
-  std::string read_define(tokenizer&, macro&);
+  void             read_macro_fn(token start, tokenizer&, macro&, bool echo);
+  void             read_macro_def(token start, tokenizer&, macro&, bool echo);
+  void             read_macro(token start, tokenizer&, macro&, bool echo);
+  std::string_view read_define(tokenizer&, macro&);
+  void             parse_body(macro&);
 
   class token_stream;
+  struct expansion_recorder;
+  struct eval_context;
 
-  eval_type eval(ppr::live_eval& tk);
-
-  token                   undefine(tokenizer&);
+  token                   read_undef(tokenizer&);
   std::tuple<token, bool> is_defined(token_stream& tk);
 
-  void expand_macro_call(transform& tf, macromap::iterator it, token_stream& tcache);
+  void expand_macro_call(basic_transform& tf, macro const& mdef, token_stream& tcache);
+  void expand_macro_body(macro const& mdef, param_substitution const& subs);
+
+  struct call_entry;
+
+  std::uint64_t call_hash(macro const& mdef, param_substitution const& subs) const;
+  bool          same_call(call_entry const& e, macro const& mdef, param_substitution const& subs) const;
+  void          clear_call_cache();
 
   enum class resolve_state
   {
@@ -183,6 +517,31 @@ private:
     rsresolve
   };
 
+  // A tokenizer taken from the pool for one source, handed back when destroyed
+  class scanner
+  {
+  public:
+    scanner(basic_transform& tr, std::string_view source);
+    ~scanner();
+
+    scanner(scanner const&)            = delete;
+    scanner& operator=(scanner const&) = delete;
+
+    tokenizer& get()
+    {
+      return *tk;
+    }
+
+  private:
+    basic_transform&   owner;
+    pmr_ptr<tokenizer> tk;
+  };
+
+  // Tokenizer and #if evaluation state of the source being preprocessed
+  struct scan_state;
+  // Handles the next token of the source, a directive or a macro call with its arguments
+  void step(scan_state&);
+
   void resolve_identifier(token start, std::string_view sv, token_stream&);
   void resolve_tokens(token_stream&, bool single = false);
 
@@ -192,131 +551,165 @@ private:
   // token_cache      cache;
   std::string_view content;
 
-  sink* last_sink;
+  Sink*            out;
+  sink*            redirect = nullptr;
+  sink_relay<Sink> relay;
 
+  // Token pastes made while resolving, released after each preprocess/eval call
+  string_arena scratch;
   macromap     macros;
+  // Idle tokenizers, a flex scanner and its buffers are set up once and reused by every call
+  std::pmr::vector<pmr_ptr<tokenizer>> scanners;
+  // Bumped on every #define/#undef, invalidates cached macro expansions
+  std::uint64_t generation = 1;
+  // See environment_hash
+  std::uint64_t env_hash   = 0;
+
+  // Definitions shared with other transforms, `macros` holds the local ones on top
+  std::shared_ptr<macro_environment const> environment;
+  // Expansions of the shared object-like macros, the environment's own are never written to
+  std::pmr::unordered_map<macro const*, macro::cached_expansion> shared_expansions;
+
+  // One argument token of a cached call, each argument ends with a ty_eof entry
+  struct call_token
+  {
+    token_type       type;
+    std::string_view space;
+    std::string_view text;
+  };
+
+  // Expansion of a function-like macro call and the arguments it was made from, views in call_strings
+  struct call_entry
+  {
+    call_entry(std::pmr::memory_resource* mr) : args(mr), tokens(mr) {}
+
+    macro const*                    mdef = nullptr;
+    ppr::pmr_vector<call_token, 16> args;
+    rtoken_cache                    tokens;
+  };
+
+  // Expanded function-like macro calls by the hash of the macro and its argument tokens, calls sharing a
+  // hash are told apart by their arguments
+  using call_cache = std::pmr::unordered_multimap<std::uint64_t, call_entry>;
+
+  call_cache    calls;
+  string_arena  call_strings;
+  cache_stats   call_cache_stats;
+  std::size_t   call_cache_limit      = 0;
+  std::uint64_t call_cache_generation = 0;
+
+  std::size_t pipeline_threshold = 0;
+  unsigned    tokenizer_threads  = 1;
+
+  // Output state of minify mode
+  struct minify_state
+  {
+    token_type last_type  = token_type::ty_eof;
+    // Last character on the output line, 0 at a line start
+    char       last       = 0;
+    bool       line_start = true;
+    bool       directive  = false;
+    // Whitespace, a newline or a comment was dropped since the last token
+    bool       gap        = false;
+    // The last token came from a macro expansion
+    bool       expanded   = false;
+  };
+
+  minify_state minified;
+
+  // Disabled source run not yet posted, see set_disabled_ranges
+  token disabled_run;
+
+  source_map*      map = nullptr;
+  // Outermost macro being expanded and the identifier that called it
+  std::string_view expanding;
+  token            call_site;
+
   std::int32_t disable_depth    = 0;
   std::int32_t if_depth         = 0;
   bool         transform_code   = false;
   bool         ignore_disabled  = true;
+  bool         lazy_defines     = true;
+  bool         minify           = false;
+  bool         disabled_ranges  = false;
   bool         err_bit          = false;
   bool         section_disabled = false;
 };
 
-struct live_eval : public sink
+template <typename Sink>
+class basic_transform<Sink>::token_range
 {
-  enum class finish_state : std::uint8_t
+public:
+  class iterator
   {
-    none,
-    end_of_seq,
-    result_available
-  };
+  public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type       = output_token;
+    using difference_type  = std::ptrdiff_t;
 
-  transform&                             tr;
-  transform::token_stream&               ts;
-  std::uint32_t                          i = 0;
-  ppr::vector<std::pair<rtoken, loc>, 2> saved;
-  std::pair<rtoken, loc> empty;
-  sink&                  chain;
+    iterator() = default;
 
-#ifndef PPR_DISABLE_RECORD
-  std::string record;
-  bool        record_content = false;
-#endif
+    output_token const& operator*() const
+    {
+      return range->current();
+    }
 
-  eval_type    result   = {};
-  finish_state finished = finish_state::none;
+    output_token const* operator->() const
+    {
+      return &range->current();
+    }
 
-  live_eval(transform& r, transform::token_stream& s, sink& cchain) : tr(r), ts(s), chain(cchain) {}
+    iterator& operator++()
+    {
+      range->advance();
+      return *this;
+    }
 
-  void reset()
-  {
-    result   = false;
-    finished = finish_state::none;
-    saved.clear();
-#ifndef PPR_DISABLE_RECORD
-    record.clear();
-#endif
-    i = 0;
-  }
-  auto const& get()
-  {
-    while (true)
-    {      
-      if (i >= static_cast<std::uint32_t>(saved.size()))
-      {
-        i = 0;
-        saved.clear();
-        tr.resolve_tokens(ts, true);
-        if (saved.empty())
-          break;
-      }
-      if (i < static_cast<std::uint32_t>(saved.size()))
-      {
-        auto& ret = saved[i++];
-        return ret;
-      }
+    void operator++(int)
+    {
+      range->advance();
     }
 
-    return empty;
-  }
+    bool operator==(std::default_sentinel_t) const
+    {
+      return range->at_end();
+    }
 
-  std::string_view value(rtoken const& t)
-  {
-    return t.svalue();
-  }
+  private:
+    friend class token_range;
+    explicit iterator(token_range* r) : range(r) {}
 
-  bool error_bit() const
-  {
-    return tr.err_bit;
-  }
+    token_range* range = nullptr;
+  };
 
-  void set_result(eval_type val)
+  token_range(token_range&&) noexcept = default;
+  token_range& operator=(token_range&&) = delete;
+  ~token_range();
+
+  iterator begin()
   {
-    result   = val;
-    finished = finish_state::result_available;
+    return iterator{this};
   }
 
-  bool has_result() const
+  std::default_sentinel_t end() const
   {
-    return finished == finish_state::result_available;
+    return {};
   }
 
-  void handle(token const& t, symvalue const& data) override
-  {
-#ifndef PPR_DISABLE_RECORD
-    if (record_content)
-    {
-      record += data.first;
-      record += data.second;
-    }
-#endif
+private:
+  friend class basic_transform;
+  struct state;
 
-    if (t.was_disabled)
-      return;
+  token_range(basic_transform& tr, std::string_view source);
 
-    if (finished != finish_state::none)
-      return;
-    if (t.type == ppr::token_type::ty_eof)
-    {
-      finished = finish_state::end_of_seq;
-      return;
-    }
-    auto ty = tr.from(t);
-    if (ty.type == ppr::token_type::ty_eof)
-    {
-      finished = finish_state::end_of_seq;
-      return;
-    }
-    if (ty.type != token_type::ty_newline)
-      saved.emplace_back(std::move(ty), (t.type != token_type::ty_rtoken) ? t.value.td.pos : loc{});
-    else
-      finished = finish_state::end_of_seq;
-  }
-  void push_error(std::string_view err, std::string_view tok, loc pos)
-  {
-    chain.error(err, tok, ppr::token(), pos);
-  }
-  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override {}
+  output_token const& current() const;
+  void                advance();
+  bool                at_end() const;
+
+  pmr_ptr<state> st;
 };
+
+using transform = basic_transform<sink>;
+
+extern template class PPR_API basic_transform<sink>;
 } // namespace ppr
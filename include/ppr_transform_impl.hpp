@@ -0,0 +1,1784 @@
+#pragma once
+
+#include "ppr_sink.hpp"
+#include "ppr_transform.hpp"
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ppr
+{
+
+// Macro names given through the API, #define gets them from the tokenizer
+inline bool is_identifier(std::string_view name)
+{
+  auto alpha = [](char c) { return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+  if (name.empty() || !alpha(name.front()))
+    return false;
+  return std::all_of(name.begin() + 1, name.end(), [&](char c) { return alpha(c) || (c >= '0' && c <= '9'); });
+}
+
+// Offset past the newline ending a directive body that starts at `from`. Follows the tokenizer rules for
+// line continuations, comments and quoted strings, all of which may carry a directive over several lines.
+inline std::size_t find_directive_end(std::string_view src, std::size_t from, int& lines)
+{
+  auto const size = src.size();
+  auto       i    = from;
+  while (i < size)
+  {
+    switch (src[i])
+    {
+    case '\n':
+      lines++;
+      return i + 1;
+    case '\\':
+      if (i + 1 < size && src[i + 1] == '\n')
+      {
+        lines++;
+        i += 2;
+        continue;
+      }
+      break;
+    case '/':
+      if (i + 1 < size && src[i + 1] == '/')
+      {
+        i = std::min(src.find('\n', i), size);
+        continue;
+      }
+      else if (i + 1 < size && src[i + 1] == '*')
+      {
+        auto end  = src.find("*/", i + 2);
+        auto stop = end == std::string_view::npos ? size : end + 2;
+        lines += static_cast<int>(std::count(src.begin() + i, src.begin() + stop, '\n'));
+        i = stop;
+        continue;
+      }
+      break;
+    case '"':
+      [[fallthrough]];
+    case '\'':
+    {
+      auto quote = src[i];
+      auto j     = i + 1;
+      bool found = false;
+      while (j < size)
+      {
+        if (src[j] == quote)
+        {
+          found = true;
+          break;
+        }
+        if (src[j] == '\\')
+        {
+          if (j + 1 >= size || src[j + 1] == '\n')
+            break;
+          j++;
+        }
+        j++;
+      }
+      if (found)
+      {
+        lines += static_cast<int>(std::count(src.begin() + i, src.begin() + j, '\n'));
+        i = j + 1;
+        continue;
+      }
+    }
+    break;
+    }
+    i++;
+  }
+  return i;
+}
+
+// True when two tokens written back to back, `a` the last character of the first, would scan differently
+inline bool needs_separation(char a, token_type first, std::string_view second)
+{
+  // Operator pairs that merge into a longer operator or start a comment
+  static constexpr std::string_view merging[] = {"++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+                                                 "->", "::", "##", "//", "/*", "+=", "-=", "*=", "/=", "%=",
+                                                 "&=", "|=", "^=", "..", ".*"};
+
+  auto word = [](char c)
+  {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  };
+
+  char b = second.front();
+  if (word(a))
+  {
+    switch (first)
+    {
+    case token_type::ty_integer:
+    case token_type::ty_hex_integer:
+    case token_type::ty_oct_integer:
+    case token_type::ty_real_number:
+      return word(b) || b == '.';
+    default:
+      return word(b) || b == '"' || b == '\'';
+    }
+  }
+  // A dot before a digit, or a sign before a non-zero digit, joins the number
+  if (a == '.' && std::isdigit(static_cast<unsigned char>(b)))
+    return true;
+  if ((a == '+' || a == '-') && b >= '1' && b <= '9')
+    return true;
+  char pair[2] = {a, b};
+  return std::find(std::begin(merging), std::end(merging), std::string_view{pair, 2}) != std::end(merging);
+}
+
+template <typename Sink>
+class basic_transform<Sink>::token_stream
+{
+
+public:
+  token_stream(tokenizer& tz, std::pmr::memory_resource* mr) : read(mr), base(&tz) {}
+  token_stream(std::pmr::memory_resource* mr) : read(mr) {}
+
+  token get()
+  {
+    while (!read.empty())
+    {
+      auto& b = read.back();
+      if (b.read < b.cache.size())
+        return token(b.cache.at(b.read++));
+      read.pop_back();
+    }
+    return base ? base->get() : token{};
+  }
+
+  token peek()
+  {
+    while (!read.empty())
+    {
+      auto& b = read.back();
+      if (b.read < b.cache.size())
+        return token(b.cache.at(b.read));
+      read.pop_back();
+    }
+    return base ? base->peek() : token{};
+  }
+
+  void push_source(rtoken_cache const& cache)
+  {
+    read.emplace_back(cache);
+  }
+
+  void save(rtoken const& t)
+  {
+    gen = t;
+  }
+
+  rtoken& get_saved()
+  {
+    return gen;
+  }
+
+private:
+  struct source
+  {
+    rtoken_cache const& cache;
+    std::uint32_t       read = 0;
+    std::uint32_t       end  = 0;
+
+    source(rtoken_cache const& rcache) : cache(rcache) {}
+  };
+
+  rtoken                 gen;
+  ppr::pmr_vector<source, 8> read;
+
+  tokenizer* base = nullptr;
+};
+
+template <typename Sink>
+struct basic_transform<Sink>::rtoken_generator
+{
+  rtoken_generator(rtoken_cache const& c) : content(c) {}
+
+  rtoken get()
+  {
+    return (pos < static_cast<std::int32_t>(content.size())) ? content[(std::size_t)(pos++)] : rtoken{};
+  }
+
+  rtoken peek()
+  {
+    return (pos < static_cast<std::int32_t>(content.size()) - 1) ? content[pos + 1] : rtoken{};
+  }
+
+  rtoken_cache const& content;
+  std::int32_t        pos = 0;
+  resolve_state       rs  = resolve_state::rsset;
+};
+
+template <typename Sink>
+struct basic_transform<Sink>::expansion_recorder : public sink
+{
+  // An error and the number of tokens recorded before it
+  struct recorded_error
+  {
+    std::size_t      index;
+    std::pmr::string message;
+    std::pmr::string what;
+    token            tok;
+    rtoken           rt;
+    loc              where;
+  };
+
+  basic_transform&                 tr;
+  rtoken_cache&                    out;
+  string_arena&                    strings;
+  sink&                            chain;
+  std::pmr::vector<recorded_error> errors;
+
+  // Record everything, comment and newline filtering is left to the real sink on replay
+  expansion_recorder(basic_transform& r, rtoken_cache& o, string_arena& s, sink& cchain)
+      : sink(0, false), tr(r), out(o), strings(s), chain(cchain), errors(r.get_memory_resource())
+  {}
+
+  void handle(token const& t, symvalue const&) override
+  {
+    auto& rt = out.emplace_back(tr.from(t));
+    rt.value = tr.retain(rt.value, strings);
+  }
+
+  // Errors are held back so the replay delivers them between the tokens they came with
+  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  {
+    auto& r = errors.emplace_back(recorded_error{out.size(), std::pmr::string{s, tr.get_memory_resource()},
+                                                 std::pmr::string{e, tr.get_memory_resource()}, t, {}, l});
+    if (t.type == token_type::ty_rtoken)
+    {
+      r.rt       = *t.value.rt;
+      r.rt.value = tr.retain(r.rt.value, strings);
+    }
+  }
+
+  // Post the recording, once redirect is back to the sink it was made for
+  void replay()
+  {
+    auto e = errors.begin();
+    for (std::size_t i = 0; i <= out.size(); ++i)
+    {
+      for (; e != errors.end() && e->index <= i; ++e)
+      {
+        if (e->tok.type == token_type::ty_rtoken)
+          e->tok.value.rt = &e->rt;
+        chain.error(e->message, e->what, e->tok, e->where);
+      }
+      if (i < out.size())
+        tr.post(token(out[i]));
+    }
+  }
+};
+
+template <typename Sink>
+struct basic_transform<Sink>::eval_context final : public live_eval
+{
+  basic_transform& tr;
+  token_stream&    ts;
+
+  eval_context(basic_transform& r, token_stream& s, sink& cchain)
+      : live_eval(cchain, r.get_memory_resource()), tr(r), ts(s)
+  {}
+
+  void resolve_next() override
+  {
+    tr.resolve_tokens(ts, true);
+  }
+
+  rtoken from(token const& t) override
+  {
+    return tr.from(t);
+  }
+
+  bool error_bit() const override
+  {
+    return tr.err_bit;
+  }
+};
+
+template <typename Sink>
+rtoken basic_transform<Sink>::from(token const& t)
+{
+  switch (t.type)
+  {
+  case token_type::ty_operator:
+
+    [[fallthrough]];
+
+  case token_type::ty_operator2:
+
+    [[fallthrough]];
+
+  case token_type::ty_bracket:
+
+    return rtoken(t.type, t.value.td.op, token_string_range(t), t.value.td.whitespaces);
+
+  case token_type::ty_rtoken:
+
+    return *t.value.rt;
+
+  default:
+  {
+    return rtoken(t.type, token_string_range(t), t.value.td.whitespaces, -1);
+  }
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::do_substitutions(param_substitution const& subs, rtoken_cache const& input, rtoken_cache& output)
+{
+  for (auto const& rt : input)
+  {
+    if (rt.replace >= 0)
+    {
+      auto const& sub = subs[rt.replace];
+      for (auto const& s : sub)
+        output.emplace_back(from(s));
+    }
+    else
+      output.push_back(rt);
+  }
+}
+
+template <typename Sink>
+std::tuple<token, bool> basic_transform<Sink>::is_defined(token_stream& tk)
+{
+  bool unexpected = false;
+  auto tok        = tk.get();
+  auto test       = tok;
+  if (tok.type == token_type::ty_keyword_ident)
+  {}
+  else if (tok.type == token_type::ty_bracket && tok.op_type() == '(')
+  {
+    tok = tk.get();
+
+    if (tok.type == token_type::ty_keyword_ident)
+    {
+      test = tok;
+      tok  = tk.get();
+      if (tok.type != token_type::ty_bracket || tok.op_type() != ')')
+        unexpected = true;
+    }
+    else
+    {
+      unexpected = true;
+    }
+  }
+  else
+    unexpected = true;
+  if (unexpected)
+  {
+    push_error("unexpected token", tok);
+    return std::tuple<token, bool>(test, false);
+  }
+  else
+  {
+    return std::tuple<token, bool>(test, is_defined(value(test)));
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::resolve_identifier(token start, std::string_view sv, token_stream& ts)
+{
+  macro*       local = nullptr;
+  macro const* found = nullptr;
+  if (auto it = macros.find(sv); it != macros.end())
+  {
+    if (!it->second.undefined)
+      found = local = &it->second;
+  }
+  else if (environment)
+    found = environment->find(sv);
+
+  if (found)
+  {
+    // The expansion's output maps to the call site in the source
+    bool outermost = expanding.empty() && start.type != token_type::ty_rtoken;
+    if (outermost)
+    {
+      expanding = sv;
+      call_site = start;
+    }
+    // Shared definitions were parsed when frozen
+    if (local && !local->body.empty())
+      parse_body(*local);
+    if (found->is_function)
+    {
+      expand_macro_call(*this, *found, ts);
+    }
+    else
+    {
+      auto& cache =
+          local ? local->expansion : shared_expansions.try_emplace(found, get_memory_resource()).first->second;
+      if (cache.generation != generation)
+      {
+        cache.tokens.clear();
+        cache.strings.clear();
+        expansion_recorder rec(*this, cache.tokens, cache.strings, current());
+        auto               save = std::exchange(redirect, &rec);
+        token_stream       ts{get_memory_resource()};
+        ts.push_source(found->content);
+        resolve_tokens(ts);
+        redirect = save;
+        rec.replay();
+        if (!err_bit)
+          cache.generation = generation;
+      }
+      else
+      {
+        for (auto const& rt : cache.tokens)
+          post(token(rt));
+      }
+    }
+    if (outermost)
+      expanding = {};
+  }
+  else
+  {
+    post(start);
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::resolve_tokens(token_stream& tk, bool single)
+{
+  resolve_state rs = resolve_state::rsset;
+  while (true)
+  {
+    if (rs == resolve_state::rsresolve)
+    {
+      auto& rtok = tk.get_saved();
+      if (rtok.type == token_type::ty_keyword_ident)
+      {
+        resolve_identifier(token(rtok), rtok.svalue(), tk);
+        if (single)
+          return;
+      }
+      else
+      {
+        post(token(rtok));
+        if (single)
+          return;
+      }
+      rs = resolve_state::rsset;
+    }
+    token start = tk.get();
+    switch (start.type)
+    {
+    case token_type::ty_blk_comment:
+      [[fallthrough]];
+    case token_type::ty_sl_comment:
+      post(start);
+      if (single)
+        return;
+      break;
+    case token_type::ty_newline:
+    case token_type::ty_eof:
+      return;
+    case token_type::ty_rtoken:
+    {
+      auto const& rr = *start.value.rt;
+      if (rs == resolve_state::rsjoin)
+      {
+        auto& last = tk.get_saved();
+        token_paste(last, rr, scratch);
+        rs = resolve_state::rsresolve;
+        break;
+      }
+      else if (rr.type == token_type::ty_operator2 && rr.op2_type() == operator2_type::op_tokpaste)
+      {
+        rs = resolve_state::rsjoin;
+        break;
+      }
+      else
+      {
+        auto next = tk.peek();
+
+        if ((next.type == token_type::ty_rtoken && next.value.rt->op2_type() == operator2_type::op_tokpaste))
+        {
+          tk.save(rr);
+          break;
+        }
+      }
+      switch (rr.type)
+      {
+      case token_type::ty_keyword_ident:
+        resolve_identifier(token(rr), rr.svalue(), tk);
+        if (single)
+          return;
+        break;
+      default:
+        post(token(rr));
+        if (single)
+          return;
+        break;
+      }
+    }
+    break;
+    case token_type::ty_keyword_ident:
+    {
+      auto sv = value(start);
+      if (sv == "defined")
+      {
+        // asking if this is defined
+        auto [tok, result] = is_defined(tk);
+        if (!ignore_disabled)
+        {
+          tok.was_disabled = true;
+          post_const(tok);
+        }
+        post(result);
+        if (single)
+          return;
+      }
+      else
+      {
+        resolve_identifier(start, sv, tk);
+        if (single)
+          return;
+      }
+    }
+    break;
+    default:
+      post(start);
+      if (single)
+        return;
+    }
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::expand_macro_call(basic_transform& tf, macro const& mdef, token_stream& tk)
+{
+  auto tok = tk.get();
+  while (istype(tok, token_type::ty_newline))
+  {
+    tok = tk.get();
+  }
+
+  if (!istype(tok, token_type::ty_bracket) || !hasop(tok, '('))
+  {
+    tf.push_error("unexpected during macro call", tok);
+    return;
+  }
+
+  token_cache        local_cache{get_memory_resource()};
+  param_substitution substitutions{get_memory_resource()};
+  bool                          done = false;
+  std::uint32_t                 depth = 1;
+
+  while (!err_bit && !done)
+  {
+    auto          tok   = tk.get();
+
+    switch (type(tok))
+    {
+    case token_type::ty_eof:
+
+      tf.push_error("unexpected during macro call", tok);
+      return;
+
+    case token_type::ty_bracket:
+
+      if (hasop(tok, '('))
+      {
+        if (!depth++)
+          break;
+      }
+      else if (hasop(tok, ')'))
+      {
+        if (!--depth)
+        {
+          if (!mdef.params.empty())
+            substitutions.emplace_back(std::move(local_cache));
+          done = true;
+          break;
+        }
+      }
+
+      local_cache.push_back(tok);
+      break;
+
+    case token_type::ty_operator:
+
+      if (depth==1 && hasop(tok, ','))
+      {
+        substitutions.emplace_back(std::move(local_cache));
+        break;
+      }
+
+      [[fallthrough]];
+    default:
+      // if next or previous was/is token paste
+      local_cache.push_back(tok);
+    }
+  }
+
+  if (!mdef.params.empty() && substitutions.size() != mdef.params.size())
+  {
+    push_error("mismatch parameter count", tok);
+    return;
+  }
+
+  if (!call_cache_limit)
+  {
+    expand_macro_body(mdef, substitutions);
+    return;
+  }
+
+  if (call_cache_generation != generation)
+  {
+    clear_call_cache();
+    call_cache_generation = generation;
+  }
+
+  auto h     = call_hash(mdef, substitutions);
+  auto [i, e] = calls.equal_range(h);
+  for (; i != e; ++i)
+  {
+    if (same_call(i->second, mdef, substitutions))
+    {
+      call_cache_stats.hits++;
+      for (auto const& rt : i->second.tokens)
+        post(token(rt));
+      return;
+    }
+  }
+
+  call_cache_stats.misses++;
+  call_entry         entry{get_memory_resource()};
+  expansion_recorder rec(*this, entry.tokens, scratch, current());
+  auto               save = std::exchange(redirect, &rec);
+  expand_macro_body(mdef, substitutions);
+  redirect = save;
+  rec.replay();
+  if (err_bit)
+    return;
+
+  // rough footprint of the entry, the entries share call_strings so the whole cache is dropped once the
+  // limit is crossed
+  std::size_t bytes = sizeof(call_entry) + entry.tokens.size() * sizeof(rtoken);
+  for (auto const& rt : entry.tokens)
+    bytes += rt.value.size();
+  for (auto const& arg : substitutions)
+  {
+    bytes += (arg.size() + 1) * sizeof(call_token);
+    for (auto const& t : arg)
+    {
+      auto [ws, v] = wspace_content_pair(t);
+      bytes += ws.size() + v.size();
+    }
+  }
+  if (call_cache_stats.bytes + bytes > call_cache_limit)
+    clear_call_cache();
+  if (bytes <= call_cache_limit)
+  {
+    entry.mdef = &mdef;
+    for (auto const& arg : substitutions)
+    {
+      for (auto const& t : arg)
+      {
+        auto [ws, v] = wspace_content_pair(t);
+        entry.args.push_back({type(t), retain(ws, call_strings), retain(v, call_strings)});
+      }
+      entry.args.push_back({token_type::ty_eof, {}, {}});
+    }
+    for (auto& rt : entry.tokens)
+      rt.value = retain(rt.value, call_strings);
+    calls.emplace(h, std::move(entry));
+    call_cache_stats.bytes += bytes;
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::expand_macro_body(macro const& mdef, param_substitution const& substitutions)
+{
+  if (mdef.params.empty())
+  {
+    token_stream ts{get_memory_resource()};
+    ts.push_source(mdef.content);
+    resolve_tokens(ts);
+  }
+  else
+  {
+    rtoken_cache out{get_memory_resource()};
+    do_substitutions(substitutions, mdef.content, out);
+    token_stream ss{get_memory_resource()};
+    ss.push_source(out);
+    resolve_tokens(ss);
+  }
+}
+
+template <typename Sink>
+std::uint64_t basic_transform<Sink>::call_hash(macro const& mdef, param_substitution const& subs) const
+{
+  // Definitions are not moved while the cache is valid, the address stands for the macro
+  auto h = mix_hash(reinterpret_cast<std::uintptr_t>(&mdef));
+  for (auto const& arg : subs)
+  {
+    for (auto const& t : arg)
+    {
+      auto [ws, v] = wspace_content_pair(t);
+      h            = hash_text(v, hash_text(ws, (h ^ static_cast<std::uint64_t>(type(t))) * 0x100000001b3ull));
+    }
+    h = mix_hash(h);
+  }
+  return h;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::same_call(call_entry const& e, macro const& mdef, param_substitution const& subs) const
+{
+  if (e.mdef != &mdef)
+    return false;
+  std::size_t i = 0;
+  for (auto const& arg : subs)
+  {
+    for (auto const& t : arg)
+    {
+      if (i >= e.args.size())
+        return false;
+      auto const& c = e.args[i++];
+      auto [ws, v]  = wspace_content_pair(t);
+      if (c.type != type(t) || c.space != ws || c.text != v)
+        return false;
+    }
+    if (i >= e.args.size() || e.args[i++].type != token_type::ty_eof)
+      return false;
+  }
+  return i == e.args.size();
+}
+
+template <typename Sink>
+void basic_transform<Sink>::clear_call_cache()
+{
+  calls.clear();
+  call_strings.clear();
+  call_cache_stats.bytes = 0;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::token_paste(rtoken& rt, token const& t, string_arena& to)
+{
+  using tt = token_type;
+  if (t.type == tt::ty_operator || t.type == tt::ty_operator2 || t.type == tt::ty_string || t.type == tt::ty_sqstring ||
+      t.type == tt::ty_newline)
+  {
+    push_error("invalid token for pasting", t);
+    return;
+  }
+  // typeof rt remains same, if it was int, it will be int etc
+  rt.value = to.concat(rt.value, value(t));
+}
+
+template <typename Sink>
+void basic_transform<Sink>::token_paste(rtoken& rt, rtoken const& t, string_arena& to)
+{
+  using tt = token_type;
+  if (t.type == tt::ty_operator || t.type == tt::ty_operator2 || t.type == tt::ty_string || t.type == tt::ty_sqstring ||
+      t.type == tt::ty_newline)
+  {
+    push_error("invalid token for pasting", t);
+    return;
+  }
+  // typeof rt remains same, if it was int, it will be int etc
+  rt.value = to.concat(rt.value, value(t));
+}
+
+template <typename Sink>
+void basic_transform<Sink>::read_macro_fn(token t, tokenizer& tk, macro& m, bool echo)
+{
+  while (!err_bit && t.type != token_type::ty_newline && t.type != token_type::ty_eof)
+  {
+    switch (t.type)
+    {
+    case token_type::ty_keyword_ident:
+    {
+
+      auto v       = value(t);
+      auto it      = std::find(m.params.begin(), m.params.end(), v);
+      int  replace = -1;
+      if (it != m.params.end())
+        replace = static_cast<int>(std::distance(m.params.begin(), it));
+
+      auto& rt   = m.content.emplace_back(from(t));
+      rt.value   = retain(rt.value, m.strings);
+      rt.replace = replace;
+    }
+    break;
+    case token_type::ty_operator:
+      [[fallthrough]];
+    case token_type::ty_operator2:
+      [[fallthrough]];
+    default:
+    {
+      auto& rt = m.content.emplace_back(from(t));
+      rt.value = retain(rt.value, m.strings);
+    }
+    break;
+    }
+    if (echo && !err_bit)
+      post(t);
+    t = tk.get();
+  }
+  if (echo && !err_bit)
+    post(t);
+}
+
+template <typename Sink>
+void basic_transform<Sink>::read_macro_def(token t, tokenizer& tk, macro& m, bool echo)
+{
+  bool tp = false;
+  while (!err_bit && t.type != token_type::ty_newline && t.type != token_type::ty_eof)
+  {
+    if (!tp)
+    {
+      if (t.type == token_type::ty_operator2 && t.value.td.op2 == operator2_type::op_tokpaste)
+      {
+        if (m.content.empty())
+        {
+          push_error("invalid placement of token paste operator", t);
+          return;
+        }
+        tp = true;
+      }
+    }
+    else
+    {
+      auto& prev = m.content.back();
+      token_paste(prev, t, m.strings);
+    }
+
+    if (echo && !err_bit)
+      post(t);
+    if (!tp)
+    {
+      auto& rt = m.content.emplace_back(from(t));
+      rt.value = retain(rt.value, m.strings);
+    }
+    t = tk.get();
+  }
+  if (echo && !err_bit)
+    post(t);
+}
+
+template <typename Sink>
+std::string_view basic_transform<Sink>::read_define(tokenizer& tk, macro& m)
+{
+  std::string_view name;
+  token       tok = tk.get();
+  if (!transform_code)
+    post(tok);
+
+  if (tok.type != token_type::ty_keyword_ident)
+  {
+    push_error("expecting a macro name", tok);
+    return name;
+  }
+
+  // The fingerprint is taken from the text either way
+  auto begin = static_cast<std::size_t>(tok.value.td.start + tok.value.td.length);
+  int  lines = 0;
+  auto end   = find_directive_end(content, begin, lines);
+  auto text  = content.substr(begin, end - begin);
+  if (transform_code && lazy_defines)
+  {
+    // Nothing is echoed, keep the text and skip the tokenizer past the definition. Name and body are stored
+    // together, a short definition makes a single allocation.
+    auto stored   = m.strings.concat(value(tok), text);
+    name          = stored.substr(0, stored.size() - text.size());
+    m.is_function = begin < content.size() && content[begin] == '(';
+    m.body        = stored.substr(name.size());
+    m.fingerprint = macro_fingerprint(name, m.is_function, text);
+    tk.skip_to(static_cast<std::int32_t>(end), lines);
+    return name;
+  }
+
+  name = retain(value(tok), m.strings);
+  read_macro(tk.get(), tk, m, !transform_code);
+  m.fingerprint = macro_fingerprint(name, m.is_function, text);
+  return name;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::read_macro(token tok, tokenizer& tk, macro& m, bool echo)
+{
+  auto get_tok = [&tk, this](bool print)
+  {
+    auto t = tk.get();
+    if (print)
+      post(t);
+    return t;
+  };
+
+  if (tok.type == token_type::ty_bracket && tok.value.td.op == '(' && tok.value.td.whitespaces == 0)
+  {
+    if (echo)
+      post(tok);
+
+    m.is_function = true;
+    bool done     = false;
+    while (!err_bit && !done)
+    {
+      auto tok = get_tok(echo);
+      switch (tok.type)
+      {
+      case token_type::ty_bracket:
+        if (tok.value.td.op == ')')
+        {
+          done = true;
+        }
+        break;
+      case token_type::ty_operator:
+        if (tok.value.td.op == ',')
+        {}
+        else
+        {
+          push_error("unexpected operator", tok);
+          return;
+        }
+        break;
+      case token_type::ty_keyword_ident:
+        m.params.emplace_back(retain(value(tok), m.strings));
+        break;
+      default:
+        push_error("unexpected token", tok);
+        return;
+      }
+    }
+    if (!err_bit)
+      tok = tk.get();
+  }
+
+  if (m.is_function)
+    read_macro_fn(tok, tk, m, echo);
+  else
+    read_macro_def(tok, tk, m, echo);
+  m.content.shrink_to_fit();
+}
+
+template <typename Sink>
+void basic_transform<Sink>::parse_body(macro& m)
+{
+  auto body = std::exchange(m.body, std::string_view{});
+  auto save = std::exchange(content, body);
+  {
+    scanner lease(*this, body);
+    auto&   tk = lease.get();
+    read_macro(tk.get(), tk, m, false);
+  }
+  content = save;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::add_macro(std::string_view name, macro&& m)
+{
+  // The first definition stays
+  if (find_macro(name))
+    return false;
+  env_hash ^= m.fingerprint;
+  auto [it, added] = macros.try_emplace(name, std::move(m));
+  // An #undef left in the way goes with the name it kept, `name` is in the new definition's arena
+  if (!added)
+  {
+    macros.erase(it);
+    macros.emplace(name, std::move(m));
+  }
+  return true;
+}
+
+template <typename Sink>
+std::shared_ptr<macro_environment const> basic_transform<Sink>::freeze()
+{
+  for (auto& [name, m] : macros)
+  {
+    if (!m.body.empty())
+      parse_body(m);
+  }
+  auto env = std::make_shared<macro_environment>(std::move(environment), get_memory_resource());
+  env->macros.swap(macros);
+  env->digest = env_hash;
+  // Expansions depend on the generation of this transform, whoever shares the environment caches their own
+  for (auto& [name, m] : env->macros)
+  {
+    m.expansion.tokens.clear();
+    m.expansion.strings.clear();
+    m.expansion.generation = 0;
+  }
+  environment = env;
+  shared_expansions.clear();
+  return env;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::reset(reset_mode mode)
+{
+  if (mode == reset_mode::clear_macros)
+  {
+    macros.clear();
+    shared_expansions.clear();
+    clear_call_cache();
+    generation++;
+    env_hash = environment ? environment->hash() : 0;
+  }
+  scratch.clear();
+  content          = {};
+  redirect         = nullptr;
+  minified         = {};
+  disabled_run     = {};
+  expanding        = {};
+  call_site        = {};
+  disable_depth    = 0;
+  if_depth         = 0;
+  err_bit          = false;
+  section_disabled = false;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::set_environment(std::shared_ptr<macro_environment const> env)
+{
+  environment = std::move(env);
+  shared_expansions.clear();
+  clear_call_cache();
+  generation++;
+  // Local definitions and undefs stay on top of the new environment
+  env_hash = environment ? environment->hash() : 0;
+  for (auto const& [name, m] : macros)
+  {
+    if (auto shared = environment ? environment->find(name) : nullptr)
+      env_hash ^= shared->fingerprint;
+    if (!m.undefined)
+      env_hash ^= m.fingerprint;
+  }
+}
+
+template <typename Sink>
+token basic_transform<Sink>::read_undef(tokenizer& tk)
+{
+  token tok = tk.get();
+
+  if (tok.type != token_type::ty_keyword_ident)
+    push_error("expecting a macro name", tok);
+  else
+    undefine(value(tok));
+
+  return tok;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::undefine(std::string_view name)
+{
+  auto visible = find_macro(name);
+  bool defined = visible != nullptr;
+  auto removed = defined ? visible->fingerprint : 0;
+  auto it      = macros.find(name);
+  bool shared  = environment && environment->find(name);
+  if (it != macros.end())
+    macros.erase(it);
+  // Keep hiding the shared definition
+  if (shared)
+  {
+    macro m{get_memory_resource()};
+    m.undefined = true;
+    macros.emplace(m.strings.store(name), std::move(m));
+  }
+  if (!defined)
+    return false;
+  env_hash ^= removed;
+  generation++;
+  return true;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::define(std::string_view name, std::string_view value)
+{
+  if (!is_identifier(name) || find_macro(name))
+    return false;
+  macro m{get_memory_resource()};
+  // The leading blank keeps the expansion apart from what precedes the call, as the one after a #define name
+  m.body        = m.strings.concat(" ", value);
+  // Fingerprinted as stored, as read_define does with the text after the name
+  m.fingerprint = macro_fingerprint(name, false, m.body);
+  if (!transform_code || !lazy_defines)
+    parse_body(m);
+  if (!add_macro(retain(name, m.strings), std::move(m)))
+    return false;
+  generation++;
+  return true;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::define_function(std::string_view name, std::span<std::string_view const> params,
+                                            std::string_view body)
+{
+  if (!is_identifier(name) || find_macro(name))
+    return false;
+  macro m{get_memory_resource()};
+  m.is_function = true;
+  // Fingerprinted as the text of #define name(a,b) body
+  std::pmr::string text{"(", get_memory_resource()};
+  for (auto p : params)
+  {
+    if (!m.params.empty())
+      text += ',';
+    text += p;
+    m.params.emplace_back(retain(p, m.strings));
+  }
+  text += ") ";
+  text += body;
+  m.fingerprint = macro_fingerprint(name, true, text);
+  auto source = m.strings.concat(" ", body);
+  auto save   = std::exchange(content, source);
+  {
+    scanner lease(*this, source);
+    auto&   tk = lease.get();
+    read_macro_fn(tk.get(), tk, m, false);
+  }
+  content = save;
+  m.content.shrink_to_fit();
+  if (!add_macro(retain(name, m.strings), std::move(m)))
+    return false;
+  generation++;
+  return true;
+}
+
+template <typename Sink>
+std::size_t basic_transform<Sink>::define_all(std::span<std::pair<std::string_view, std::string_view> const> definitions)
+{
+  macros.reserve(macros.size() + definitions.size());
+  std::size_t added = 0;
+  for (auto const& [name, value] : definitions)
+    added += define(name, value) ? 1 : 0;
+  return added;
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::gather_disabled(token const& t)
+{
+  switch (t.type)
+  {
+  case token_type::ty_eof:
+  case token_type::ty_true:
+  case token_type::ty_false:
+  case token_type::ty_raw:
+  case token_type::ty_rtoken:
+    break;
+  default:
+    if (t.was_disabled)
+    {
+      auto  begin = t.value.td.start - t.value.td.whitespaces;
+      auto  end   = t.value.td.start + t.value.td.length;
+      auto& run   = disabled_run.value.td;
+      if (disabled_run.type == token_type::ty_source_range && begin >= run.start + run.length)
+      {
+        run.length = end - run.start;
+        return true;
+      }
+      flush_disabled();
+      disabled_run.type         = token_type::ty_source_range;
+      disabled_run.was_disabled = true;
+      run.start                 = begin;
+      run.length                = end - begin;
+      run.pos                   = t.value.td.pos;
+      run.whitespaces           = 0;
+      return true;
+    }
+    break;
+  }
+  flush_disabled();
+  return false;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::flush_disabled()
+{
+  if (disabled_run.type != token_type::ty_source_range)
+    return;
+  auto run          = disabled_run;
+  disabled_run.type = token_type::ty_eof;
+#ifndef NDEBUG
+  run.sym = content_value(run.value.td.start, run.value.td.length);
+#endif
+  deliver_out(run);
+}
+
+template <typename Sink>
+void basic_transform<Sink>::deliver_minified(token const& t)
+{
+  auto ty = type(t);
+  if (!out->accept(t, ty))
+    return;
+
+  auto [ws, text] = wspace_content_pair(t);
+  // Source tokens written without whitespace between them already scan apart
+  bool             expanded = t.type == token_type::ty_rtoken || t.type == token_type::ty_raw;
+  bool             apart    = !ws.empty() || minified.gap || expanded || minified.expanded;
+  std::string_view space;
+  switch (ty)
+  {
+  case token_type::ty_sl_comment:
+  case token_type::ty_blk_comment:
+    minified.gap = true;
+    return;
+  case token_type::ty_newline:
+    minified.line_start = true;
+    minified.gap        = true;
+    if (!minified.directive)
+      return;
+    minified.directive = false;
+    minified.last      = 0;
+    break;
+  default:
+    if (minified.line_start && ty == token_type::ty_operator && text == "#")
+    {
+      // A directive starts its own line
+      minified.directive = true;
+      if (minified.last)
+        space = "\n";
+    }
+    else if (minified.last && apart && !text.empty() &&
+             (needs_separation(minified.last, minified.last_type, text) ||
+              (minified.directive && minified.last_type == token_type::ty_keyword_ident && text == "(")))
+      space = " "; // `#define X (1)` is not a function-like macro
+    minified.line_start = false;
+    minified.gap        = false;
+    if (!text.empty())
+    {
+      minified.last      = text.back();
+      minified.last_type = ty;
+      minified.expanded  = expanded;
+    }
+    break;
+  }
+  if (map)
+    map_output(t, space.size(), text.size());
+  out->handle(t, {space, text});
+}
+
+template <typename Sink>
+void basic_transform<Sink>::deliver_mapped(token const& t)
+{
+  auto ty = type(t);
+  if (!out->accept(t, ty))
+    return;
+
+  auto data = wspace_content_pair(t);
+  map_output(t, data.first.size(), data.second.size());
+  out->handle(t, data);
+}
+
+template <typename Sink>
+void basic_transform<Sink>::map_output(token const& t, std::size_t space, std::size_t length)
+{
+  if (!expanding.empty())
+  {
+    map->add_expanded(space + length, expanding, call_site.value.td.start, call_site.value.td.pos.line);
+    return;
+  }
+  switch (t.type)
+  {
+  case token_type::ty_rtoken:
+  case token_type::ty_raw:
+  case token_type::ty_true:
+  case token_type::ty_false:
+    map->add_opaque(space + length);
+    break;
+  default:
+  {
+    // Newlines and block comments carry the location where they end
+    auto line = t.value.td.pos.line;
+    if (t.type == token_type::ty_newline)
+      line--;
+    else if (t.type == token_type::ty_blk_comment)
+    {
+      auto text = content_value(t.value.td.start, t.value.td.length);
+      line -= static_cast<std::int32_t>(std::count(text.begin(), text.end(), '\n'));
+    }
+    if (space <= static_cast<std::size_t>(t.value.td.whitespaces))
+      map->add_source(space + length, t.value.td.start - static_cast<std::int32_t>(space), line);
+    else
+    {
+      // Whitespace minify mode put in, the source has none
+      map->extend(space);
+      map->add_source(length, t.value.td.start, line);
+    }
+  }
+  break;
+  }
+}
+
+template <typename Sink>
+basic_transform<Sink>::scanner::scanner(basic_transform& tr, std::string_view source) : owner(tr)
+{
+  if (owner.scanners.empty())
+    tk = make_pmr<tokenizer>(owner.get_memory_resource(), source, owner.current(), owner.get_memory_resource());
+  else
+  {
+    tk = std::move(owner.scanners.back());
+    owner.scanners.pop_back();
+    tk->reset(source, owner.current());
+  }
+  tk->set_elide_comments(owner.elide_comments());
+}
+
+template <typename Sink>
+basic_transform<Sink>::scanner::~scanner()
+{
+  owner.scanners.push_back(std::move(tk));
+}
+
+template <typename Sink>
+struct basic_transform<Sink>::scan_state
+{
+  scanner                   lease;
+  tokenizer&                tk;
+  // Tokenizes ahead on another thread, see set_pipeline_threshold
+  std::optional<token_pipe> pipe;
+  token_stream              ts;
+  eval_context              le;
+  token                     saved;
+  bool                      done = false;
+
+  scan_state(basic_transform& tr, std::string_view source)
+      : lease(tr, source), tk(lease.get()), ts(tk, tr.get_memory_resource()), le(tr, ts, tr.current())
+  {
+    if (tr.pipeline_threshold && source.size() >= tr.pipeline_threshold)
+      tk.attach(&pipe.emplace(source, tk.elide_comments(), tr.tokenizer_threads));
+    // Disabled ranges take the #if line from the source instead
+    le.record_content = !tr.ignore_disabled && !tr.disabled_ranges;
+    tr.content        = source;
+  }
+};
+
+template <typename Sink>
+void basic_transform<Sink>::step(scan_state& st)
+{
+  auto& tk    = st.tk;
+  auto& ts    = st.ts;
+  auto& le    = st.le;
+  auto& saved = st.saved;
+  auto tok     = tk.get();
+  bool handled = false;
+  bool flip    = false;
+  switch (tok.type)
+  {
+  case token_type::ty_eof:
+    st.done = true;
+    break;
+  case token_type::ty_preprocessor:
+  {
+    switch (tok.value.td.pp_type)
+    {
+    case preprocessor_type::pp_define:
+      if (!section_disabled)
+      {
+        macro m{get_memory_resource()};
+        if (!transform_code)
+        {
+          post(saved);
+          post(tok);
+        }
+        auto name = read_define(tk, m);
+        if (!err_bit && add_macro(name, std::move(m)))
+          generation++;
+        handled = true;
+      }
+      break;
+    case preprocessor_type::pp_ifndef:
+      flip = true;
+      [[fallthrough]];
+    case preprocessor_type::pp_ifdef:
+      if_depth++;
+      if (!section_disabled)
+      {
+        auto [t, res]    = is_defined(ts);
+        section_disabled = !res;
+        if (flip)
+          section_disabled = !section_disabled;
+
+#ifndef PPR_DISABLE_RECORD
+        if (!ignore_disabled)
+        {
+          saved.was_disabled = true;
+          tok.was_disabled   = true;
+          t.was_disabled     = true;
+          post_const(saved);
+          post_const(tok);
+          post_const(t);
+        }
+
+#endif
+        handled = true;
+      }
+      else
+      {
+        disable_depth++;
+      }
+      break;
+    case preprocessor_type::pp_if:
+      if_depth++;
+      if (!section_disabled)
+      {
+        auto save        = std::exchange(redirect, &le);
+        section_disabled = !(bool)le.evaluate();
+        redirect = save;
+#ifndef PPR_DISABLE_RECORD
+        if (!ignore_disabled && section_disabled)
+        {
+          post(saved);
+          post(tok);
+          if (le.record_content)
+          {
+            std::string_view recorded = le.record;
+            post(token(recorded));
+          }
+        }
+
+#endif
+        le.reset();
+        handled = true;
+      }
+      else
+      {
+        disable_depth++;
+      }
+      break;
+    case preprocessor_type::pp_elif:
+      if (!disable_depth && section_disabled)
+      {
+        auto save        = std::exchange(redirect, &le);
+        section_disabled = false; // Unset here so that next tokens are accepted
+        section_disabled = !(bool)le.evaluate();
+        redirect = save;
+#ifndef PPR_DISABLE_RECORD
+        if (!ignore_disabled && section_disabled)
+        {
+          post(saved);
+          post(tok);
+          if (le.record_content)
+          {
+            std::string_view recorded = le.record;
+            post(token(recorded));
+          }
+        }
+#endif
+        le.reset();
+        handled = true;
+      }
+      else
+      {
+        section_disabled = true;
+      }
+      break;
+    case preprocessor_type::pp_else:
+      if (section_disabled)
+      {
+        if (!disable_depth)
+        {
+#ifndef PPR_DISABLE_RECORD
+          if (!ignore_disabled)
+          {
+            post(saved);
+            post(tok);
+          }
+#endif
+          section_disabled = false;
+          handled          = true;
+        }
+      }
+      else
+        section_disabled = true;
+      break;
+    case preprocessor_type::pp_endif:
+      --if_depth;
+      if (section_disabled)
+      {
+        if (!disable_depth)
+        {
+#ifndef PPR_DISABLE_RECORD
+          if (!ignore_disabled)
+          {
+            post(saved);
+            post(tok);
+          }
+#endif
+          section_disabled = false; // unlock
+          handled          = true;
+        }
+        else
+          disable_depth--;
+      }
+      else
+      {
+#ifndef PPR_DISABLE_RECORD
+        if (!ignore_disabled)
+        {
+          saved.was_disabled = true;
+          tok.was_disabled   = true;
+          post_const(saved);
+          post_const(tok);
+        }
+#endif
+        handled = true;
+      }
+      break;
+    case preprocessor_type::pp_undef:
+      if (!section_disabled)
+      {
+        auto t = read_undef(tk);
+
+#ifndef PPR_DISABLE_RECORD
+        if (!ignore_disabled)
+        {
+          saved.was_disabled = true;
+          tok.was_disabled   = true;
+          t.was_disabled     = true;
+          post_const(saved);
+          post_const(tok);
+          post_const(t);
+        }
+#endif
+
+        handled = true;
+      }
+      break;
+    }
+
+    if (!handled && (!section_disabled || !ignore_disabled))
+    {
+      post(saved);
+      post(tok);
+    }
+  }
+  break;
+  default:
+    if (!(tok.type == token_type::ty_operator && tok.value.td.op == '#' &&
+          tk.peek().type == token_type::ty_preprocessor))
+    {
+      if (transform_code && !section_disabled)
+      {
+        if (tok.type == token_type::ty_keyword_ident)
+        {
+          resolve_identifier(tok, value(tok), ts);
+        }
+        else
+          post(tok);
+      }
+      else if ((!section_disabled || !ignore_disabled))
+        post(tok);
+    }
+
+    saved = tok;
+  }
+}
+
+template <typename Sink>
+void basic_transform<Sink>::preprocess(std::string_view source)
+{
+  minified.line_start = true;
+  if (map)
+    map->begin_source();
+  scan_state st(*this, source);
+  while (!err_bit && !st.done)
+    step(st);
+  if (disabled_ranges)
+    flush_disabled();
+  if constexpr (requires(Sink& s) { s.flush(); })
+    out->flush();
+  content = {};
+  scratch.clear();
+}
+
+template <typename Sink>
+struct basic_transform<Sink>::token_range::state
+{
+  // Stands in for the sink, tokens made by macro handling are copied as they may not outlive the step
+  struct collector final : public sink
+  {
+    std::pmr::vector<output_token>    tokens;
+    std::pmr::deque<rtoken>           rtokens;
+    // Recorded text of disabled #if conditions
+    std::pmr::deque<std::string_view> raw;
+    string_arena                      text;
+    sink&                             chain;
+
+    collector(sink& cchain, bool ignore_all_comments, std::pmr::memory_resource* mr)
+        : sink(1, ignore_all_comments), tokens(mr), rtokens(mr), raw(mr), text(mr, 4 * 1024), chain(cchain)
+    {}
+
+    void handle(token const& t, symvalue const& data) override
+    {
+      switch (t.type)
+      {
+      case token_type::ty_rtoken:
+      {
+        auto& rt        = rtokens.emplace_back(*t.value.rt);
+        rt.value        = text.store(rt.value);
+        auto& ot        = tokens.emplace_back(output_token{t, rt.sspace(), rt.svalue()});
+        ot.tok.value.rt = &rt;
+      }
+      break;
+      case token_type::ty_raw:
+      {
+        auto& r          = raw.emplace_back(text.store(*t.value.raw));
+        auto& ot         = tokens.emplace_back(output_token{t, std::string_view{}, r});
+        ot.tok.value.raw = &r;
+      }
+      break;
+      default:
+        tokens.emplace_back(output_token{t, data.first, data.second});
+        break;
+      }
+    }
+
+    void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+    {
+      chain.error(s, e, t, l);
+    }
+
+    void clear()
+    {
+      tokens.clear();
+      rtokens.clear();
+      raw.clear();
+      text.clear();
+    }
+  };
+
+  basic_transform& tr;
+  sink*            prev;
+  collector        coll;
+  scan_state       scan;
+  std::size_t      next     = 0;
+  bool             finished = false;
+
+  state(basic_transform& t, std::string_view source)
+      : tr(t), prev(t.redirect), coll(t.current(), t.elide_comments(), t.get_memory_resource()), scan(t, source)
+  {
+    tr.redirect = &coll;
+    fill();
+  }
+
+  ~state()
+  {
+    finish();
+  }
+
+  // Steps through the source until it posts something
+  void fill()
+  {
+    next = 0;
+    coll.clear();
+    while (coll.tokens.empty() && !tr.err_bit && !scan.done)
+      tr.step(scan);
+    if (coll.tokens.empty())
+      finish();
+  }
+
+  void finish()
+  {
+    if (finished)
+      return;
+    finished    = true;
+    tr.redirect = prev;
+    tr.content  = {};
+    tr.scratch.clear();
+  }
+};
+
+template <typename Sink>
+basic_transform<Sink>::token_range::token_range(basic_transform& tr, std::string_view source)
+    : st(make_pmr<state>(tr.get_memory_resource(), tr, source))
+{}
+
+template <typename Sink>
+basic_transform<Sink>::token_range::~token_range() = default;
+
+template <typename Sink>
+output_token const& basic_transform<Sink>::token_range::current() const
+{
+  return st->coll.tokens[st->next];
+}
+
+template <typename Sink>
+void basic_transform<Sink>::token_range::advance()
+{
+  if (++st->next == st->coll.tokens.size())
+    st->fill();
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::token_range::at_end() const
+{
+  return st->next == st->coll.tokens.size();
+}
+
+template <typename Sink>
+typename basic_transform<Sink>::token_range basic_transform<Sink>::tokens(std::string_view source)
+{
+  return token_range{*this, source};
+}
+
+template <typename Sink>
+void basic_transform<Sink>::preprocess_file(std::string const& path)
+{
+  // Tokens and their views into the file do not outlive preprocess, macros keep copies
+  mapped_source source(path);
+  if (!source)
+  {
+    push_error("unable to read file", path, loc{});
+    return;
+  }
+  preprocess(source.view());
+}
+
+template <typename Sink>
+bool basic_transform<Sink>::eval_bool(std::string_view sv)
+{
+  scanner      lease(*this, sv);
+  token_stream ts(lease.get(), get_memory_resource());
+  eval_context le(*this, ts, current());
+  content     = sv;
+  auto prev = std::exchange(redirect, &le);
+  bool result = (bool)le.evaluate();
+  redirect = prev;
+  content     = {};
+  scratch.clear();
+  return result;
+}
+
+template <typename Sink>
+std::uint64_t basic_transform<Sink>::eval_uint(std::string_view sv)
+{
+  scanner      lease(*this, sv);
+  token_stream ts(lease.get(), get_memory_resource());
+  eval_context le(*this, ts, current());
+  content     = sv;
+  auto prev   = std::exchange(redirect, &le);
+  auto result = le.evaluate().uval();
+  redirect = prev;
+  content     = {};
+  scratch.clear();
+  return result;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::push_error(std::string_view s, token const& t)
+{
+  current().error(s, value(t), t, t.type != token_type::ty_rtoken ? t.value.td.pos : loc{});
+  err_bit = true;
+}
+
+template <typename Sink>
+void basic_transform<Sink>::push_error(std::string_view s, std::string_view t, loc const& l)
+{
+  current().error(s, t, {}, l);
+  err_bit = true;
+}
+
+} // namespace ppr
\ No newline at end of file
@@ -0,0 +1,102 @@
+
+#include "ppr_batch.hpp"
+#include <algorithm>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace ppr
+{
+
+// Job indices of one worker. Jobs are whole files, a lock per take costs nothing next to them.
+struct batch::queue
+{
+  std::mutex              lock;
+  std::deque<std::size_t> jobs;
+
+  std::optional<std::size_t> take_front()
+  {
+    std::lock_guard guard(lock);
+    if (jobs.empty())
+      return {};
+    auto i = jobs.front();
+    jobs.pop_front();
+    return i;
+  }
+
+  // Thieves take the jobs the owner would reach last
+  std::optional<std::size_t> take_back()
+  {
+    std::lock_guard guard(lock);
+    if (jobs.empty())
+      return {};
+    auto i = jobs.back();
+    jobs.pop_back();
+    return i;
+  }
+};
+
+batch::batch(unsigned threads) : thread_count(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{}
+
+std::size_t batch::run(std::span<job> jobs)
+{
+  if (jobs.empty())
+    return 0;
+
+  auto                     count = std::min<std::size_t>(thread_count, jobs.size());
+  std::unique_ptr<queue[]> queues(new queue[count]);
+  std::size_t              dealt = 0;
+  for (std::size_t i = 0; i < jobs.size(); ++i)
+  {
+    jobs[i].failed = !jobs[i].output;
+    if (!jobs[i].failed)
+      queues[dealt++ % count].jobs.push_back(i);
+    else if (done)
+      done(i);
+  }
+
+  std::span<queue>         all{queues.get(), count};
+  std::vector<std::thread> workers;
+  for (std::size_t w = 1; w < count; ++w)
+    workers.emplace_back([this, jobs, all, w] { work(jobs, all, w); });
+  work(jobs, all, 0);
+  for (auto& t : workers)
+    t.join();
+
+  return static_cast<std::size_t>(std::count_if(jobs.begin(), jobs.end(), [](job const& j) { return j.failed; }));
+}
+
+void batch::work(std::span<job> jobs, std::span<queue> queues, std::size_t self)
+{
+  std::pmr::unsynchronized_pool_resource pool;
+  transform                              ctx(&pool);
+  while (true)
+  {
+    auto next = queues[self].take_front();
+    // No job is added while running, all queues found empty means the batch is done
+    for (std::size_t k = 1; !next && k < queues.size(); ++k)
+      next = queues[(self + k) % queues.size()].take_back();
+    if (!next)
+      return;
+    process(ctx, jobs[*next], *next);
+  }
+}
+
+void batch::process(transform& ctx, job& j, std::size_t index)
+{
+  ctx.exchange(j.output);
+  ctx.reset(reset_mode::clear_macros);
+  ctx.set_environment(j.environment);
+  if (setup)
+    setup(ctx, index);
+  ctx.preprocess(j.source);
+  j.failed = ctx.error_bit();
+  if (done)
+    done(index);
+}
+
+} // namespace ppr
@@ -0,0 +1,296 @@
+
+#include "ppr_binary_stream.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+namespace ppr
+{
+
+// Value and suffix of an integer token, false when it is not representable or the value would not give back
+// its spelling (see binary_stream)
+static bool parse_integer(token_type type, std::string_view s, std::uint64_t& value, bool& negative,
+                          std::string_view& suffix)
+{
+  negative = !s.empty() && s[0] == '-';
+  if (negative)
+    s.remove_prefix(1);
+  int base = type == token_type::ty_hex_integer ? 16 : type == token_type::ty_oct_integer ? 8 : 10;
+  if (base == 16 && s.size() < 2)
+    return false;
+  auto from      = s.data() + (base == 16 ? 2 : 0);
+  auto [end, ec] = std::from_chars(from, s.data() + s.size(), value, base);
+  if (ec != std::errc{} || end == from)
+    return false;
+  suffix = std::string_view{end, static_cast<std::size_t>(s.data() + s.size() - end)};
+
+  char  spelling[24];
+  char* p = spelling;
+  if (base == 16)
+  {
+    *p++ = '0';
+    *p++ = 'x';
+  }
+  else if (base == 8 && value)
+    *p++ = '0';
+  p = std::to_chars(p, std::end(spelling), value, base).ptr;
+  if (base == 16)
+    std::transform(spelling + 2, p, spelling + 2, [](char c) { return static_cast<char>(std::toupper(c)); });
+  return std::string_view{spelling, static_cast<std::size_t>(p - spelling)} ==
+         std::string_view{s.data(), static_cast<std::size_t>(end - s.data())};
+}
+
+binary_sink::binary_sink(bool with_locations, int max_consequitive_empty_lines, bool ignore_all_comments)
+    : sink(max_consequitive_empty_lines, ignore_all_comments), locations(with_locations)
+{
+  clear();
+}
+
+void binary_sink::clear()
+{
+  stream.clear();
+  idents.clear();
+  last_line = 0;
+  stream.insert(stream.end(), std::begin(binary_stream::magic), std::end(binary_stream::magic));
+  stream.push_back(binary_stream::version);
+  stream.push_back(locations ? binary_stream::with_locations : 0);
+}
+
+void binary_sink::put(std::uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    stream.push_back(static_cast<std::uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  stream.push_back(static_cast<std::uint8_t>(v));
+}
+
+void binary_sink::put(std::string_view text)
+{
+  put(text.size());
+  stream.insert(stream.end(), text.begin(), text.end());
+}
+
+void binary_sink::handle(token const& t, symvalue const& data)
+{
+  auto type = t.type == token_type::ty_rtoken ? t.value.rt->type : t.type;
+  if (type == token_type::ty_eof)
+    return;
+
+  std::uint8_t kind = static_cast<std::uint8_t>(type) & binary_stream::type_mask;
+  if (!data.first.empty())
+    kind |= binary_stream::has_space;
+  if (t.was_disabled)
+    kind |= binary_stream::disabled;
+
+  auto text    = data.second;
+  bool encoded = true;
+  switch (type)
+  {
+  case token_type::ty_true:
+  case token_type::ty_false:
+  case token_type::ty_newline:
+    stream.push_back(kind);
+    break;
+  case token_type::ty_operator:
+  case token_type::ty_bracket:
+  case token_type::ty_braces:
+    encoded = text.size() == 1;
+    if (encoded)
+    {
+      stream.push_back(kind);
+      stream.push_back(static_cast<std::uint8_t>(text[0]));
+    }
+    break;
+  case token_type::ty_operator2:
+    stream.push_back(kind);
+    stream.push_back(static_cast<std::uint8_t>(t.type == token_type::ty_rtoken ? t.value.rt->op2 : t.value.td.op2));
+    break;
+  case token_type::ty_keyword_ident:
+  {
+    stream.push_back(kind);
+    auto it = idents.find(text);
+    if (it != idents.end())
+      put(it->second);
+    else
+    {
+      auto id = static_cast<std::uint32_t>(idents.size());
+      idents.emplace(std::string{text}, id);
+      put(id);
+      put(text);
+    }
+  }
+  break;
+  case token_type::ty_integer:
+  case token_type::ty_hex_integer:
+  case token_type::ty_oct_integer:
+  {
+    std::uint64_t    value;
+    bool             negative;
+    std::string_view suffix;
+    encoded = parse_integer(type, text, value, negative, suffix);
+    if (encoded)
+    {
+      stream.push_back(kind);
+      put(value);
+      stream.push_back(negative ? 1 : 0);
+      put(suffix);
+    }
+  }
+  break;
+  default:
+    encoded = false;
+    break;
+  }
+  if (!encoded)
+  {
+    stream.push_back(kind | binary_stream::text_payload);
+    put(text);
+  }
+
+  if (locations)
+  {
+    auto l     = (t.type != token_type::ty_rtoken && t.type != token_type::ty_raw) ? t.value.td.pos : loc{};
+    auto delta = static_cast<std::int64_t>(l.line) - last_line;
+    put((static_cast<std::uint64_t>(delta) << 1) ^ static_cast<std::uint64_t>(delta >> 63));
+    put(static_cast<std::uint64_t>(static_cast<std::uint32_t>(l.column)));
+    last_line = l.line;
+  }
+}
+
+void binary_sink::error(std::string_view s, std::string_view e, ppr::token, ppr::loc l)
+{
+  std::string msg{s};
+  msg += " - ";
+  msg += e;
+  msg += " l(" + std::to_string(l.line) + ":" + std::to_string(l.column) + ")";
+  messages.emplace_back(std::move(msg));
+}
+
+binary_reader::binary_reader(std::span<std::uint8_t const> stream) : in(stream)
+{
+  if (in.size() < binary_stream::header_size ||
+      std::memcmp(in.data(), binary_stream::magic, sizeof(binary_stream::magic)) != 0 ||
+      in[4] != binary_stream::version)
+  {
+    bad = true;
+    return;
+  }
+  locations = (in[5] & binary_stream::with_locations) != 0;
+}
+
+bool binary_reader::get(std::uint64_t& v)
+{
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (pos >= in.size())
+      return false;
+    auto b = in[pos++];
+    v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool binary_reader::get(std::string_view& text)
+{
+  std::uint64_t len;
+  if (!get(len) || len > in.size() - pos)
+    return false;
+  text = std::string_view{reinterpret_cast<char const*>(in.data() + pos), static_cast<std::size_t>(len)};
+  pos += static_cast<std::size_t>(len);
+  return true;
+}
+
+bool binary_reader::next(binary_token& t)
+{
+  if (bad || pos >= in.size())
+    return false;
+
+  auto kind  = in[pos++];
+  t          = binary_token{};
+  t.type     = static_cast<token_type>(kind & binary_stream::type_mask);
+  t.space    = (kind & binary_stream::has_space) != 0;
+  t.disabled = (kind & binary_stream::disabled) != 0;
+
+  bool ok = true;
+  if (kind & binary_stream::text_payload)
+  {
+    t.verbatim = true;
+    ok         = get(t.text);
+  }
+  else
+  {
+    switch (t.type)
+    {
+    case token_type::ty_true:
+    case token_type::ty_false:
+    case token_type::ty_newline:
+      break;
+    case token_type::ty_operator:
+    case token_type::ty_bracket:
+    case token_type::ty_braces:
+    case token_type::ty_operator2:
+      ok = pos < in.size();
+      if (ok)
+      {
+        if (t.type == token_type::ty_operator2)
+          t.op2 = static_cast<operator2_type>(in[pos]);
+        else
+        {
+          t.op   = static_cast<operator_type>(in[pos]);
+          t.text = std::string_view{reinterpret_cast<char const*>(in.data() + pos), 1};
+        }
+        pos++;
+      }
+      break;
+    case token_type::ty_keyword_ident:
+    {
+      std::uint64_t id;
+      ok = get(id);
+      if (ok && id == names.size())
+      {
+        std::string_view name;
+        ok = get(name);
+        names.push_back(name);
+      }
+      ok = ok && id < names.size();
+      if (ok)
+      {
+        t.ident = static_cast<std::uint32_t>(id);
+        t.text  = names[t.ident];
+      }
+    }
+    break;
+    case token_type::ty_integer:
+    case token_type::ty_hex_integer:
+    case token_type::ty_oct_integer:
+      ok = get(t.value) && pos < in.size();
+      if (ok)
+      {
+        t.negative = in[pos++] != 0;
+        ok         = get(t.text);
+      }
+      break;
+    default:
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok && locations)
+  {
+    std::uint64_t delta, column;
+    ok = get(delta) && get(column);
+    line += static_cast<std::int32_t>(static_cast<std::int64_t>(delta >> 1) ^ -static_cast<std::int64_t>(delta & 1));
+    t.location = loc{line, static_cast<std::int32_t>(column)};
+  }
+  bad = !ok;
+  return ok;
+}
+
+} // namespace ppr
@@ -0,0 +1,124 @@
+
+#include "ppr_fd_sink.hpp"
+#include <cerrno>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace ppr
+{
+
+// Writes all of `parts`, retrying partial writes and interrupted calls
+static bool write_all(int fd, std::string_view* parts, int count)
+{
+#ifdef _WIN32
+  for (int i = 0; i < count; ++i)
+  {
+    auto p = parts[i];
+    while (!p.empty())
+    {
+      auto r = _write(fd, p.data(), static_cast<unsigned>(p.size()));
+      if (r < 0)
+        return false;
+      p.remove_prefix(static_cast<std::size_t>(r));
+    }
+  }
+  return true;
+#else
+  while (count)
+  {
+    iovec iov[2];
+    for (int i = 0; i < count; ++i)
+      iov[i] = iovec{const_cast<char*>(parts[i].data()), parts[i].size()};
+    auto r = ::writev(fd, iov, count);
+    if (r < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    auto written = static_cast<std::size_t>(r);
+    while (count && written >= parts->size())
+    {
+      written -= parts->size();
+      parts++;
+      count--;
+    }
+    if (count)
+      parts->remove_prefix(written);
+  }
+  return true;
+#endif
+}
+
+fd_sink::fd_sink(int out_fd, int err_fd, std::size_t buffer_size)
+    : buffer(new char[buffer_size ? buffer_size : 1]), capacity(buffer_size ? buffer_size : 1), out(out_fd),
+      err(err_fd)
+{}
+
+fd_sink::~fd_sink()
+{
+  flush();
+}
+
+void fd_sink::reserve(std::size_t size)
+{
+  if (size <= capacity)
+    return;
+  drain();
+  buffer.reset(new char[size]);
+  capacity = size;
+}
+
+void fd_sink::flush()
+{
+  range_sink::flush();
+  drain();
+}
+
+void fd_sink::drain()
+{
+  if (used && !write_failed)
+  {
+    std::string_view part{buffer.get(), used};
+    write_failed = !write_all(out, &part, 1);
+  }
+  used = 0;
+}
+
+void fd_sink::spill(std::string_view text)
+{
+  if (text.size() < capacity / 2)
+  {
+    drain();
+    std::memcpy(buffer.get(), text.data(), text.size());
+    used = text.size();
+    return;
+  }
+  // Large ranges skip the copy
+  std::string_view parts[2] = {{buffer.get(), used}, text};
+  if (!write_failed)
+    write_failed = !write_all(out, used ? parts : parts + 1, used ? 2 : 1);
+  used = 0;
+}
+
+void fd_sink::error(std::string_view s, std::string_view e, ppr::token, ppr::loc l)
+{
+  // Keep the order of output and errors when both go to the same descriptor
+  if (err == out)
+    flush();
+  std::string msg = "error : ";
+  msg += s;
+  msg += " - ";
+  msg += e;
+  msg += "l(" + std::to_string(l.line) + ":" + std::to_string(l.column) + ")\n";
+  std::string_view part{msg};
+  write_all(err, &part, 1);
+}
+
+} // namespace ppr
@@ -0,0 +1,134 @@
+
+#include "ppr_mapped_source.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ppr
+{
+
+#ifdef _WIN32
+
+mapped_source::mapped_source(std::string const& path)
+{
+  auto f = std::fopen(path.c_str(), "rb");
+  if (!f)
+    return;
+  std::fseek(f, 0, SEEK_END);
+  auto size = std::ftell(f);
+  std::fseek(f, 0, SEEK_SET);
+  if (size < 0)
+  {
+    std::fclose(f);
+    return;
+  }
+  if (size > 0)
+  {
+    buffer.reset(new char[static_cast<std::size_t>(size)]);
+    length = std::fread(buffer.get(), 1, static_cast<std::size_t>(size), f);
+    data   = buffer.get();
+  }
+  ok = !std::ferror(f);
+  std::fclose(f);
+}
+
+#else
+
+mapped_source::mapped_source(std::string const& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0)
+  {
+    ::close(fd);
+    return;
+  }
+
+  auto size = static_cast<std::size_t>(st.st_size);
+  if (size >= map_threshold)
+  {
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED)
+    {
+      ::madvise(addr, size, MADV_SEQUENTIAL);
+      data   = static_cast<char const*>(addr);
+      length = size;
+      mapped = true;
+      ok     = true;
+    }
+  }
+
+  if (!mapped && size)
+  {
+    // Small file, or a file system that does not map
+    buffer.reset(new char[size]);
+    std::size_t done = 0;
+    while (done < size)
+    {
+      auto r = ::read(fd, buffer.get() + done, size - done);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        break;
+      done += static_cast<std::size_t>(r);
+    }
+    data   = buffer.get();
+    length = done;
+    ok     = done == size;
+  }
+  else if (!size)
+    ok = true;
+
+  ::close(fd);
+}
+
+#endif
+
+mapped_source::~mapped_source()
+{
+  release();
+}
+
+mapped_source::mapped_source(mapped_source&& other) noexcept
+    : data(std::exchange(other.data, nullptr)), length(std::exchange(other.length, 0)),
+      buffer(std::move(other.buffer)), mapped(std::exchange(other.mapped, false)), ok(std::exchange(other.ok, false))
+{}
+
+mapped_source& mapped_source::operator=(mapped_source&& other) noexcept
+{
+  if (this != &other)
+  {
+    release();
+    data   = std::exchange(other.data, nullptr);
+    length = std::exchange(other.length, 0);
+    buffer = std::move(other.buffer);
+    mapped = std::exchange(other.mapped, false);
+    ok     = std::exchange(other.ok, false);
+  }
+  return *this;
+}
+
+void mapped_source::release()
+{
+#ifndef _WIN32
+  if (mapped)
+    ::munmap(const_cast<char*>(data), length);
+#endif
+  buffer.reset();
+  data   = nullptr;
+  length = 0;
+  mapped = false;
+  ok     = false;
+}
+
+} // namespace ppr
@@ -0,0 +1,181 @@
+
+#include "ppr_source_map.hpp"
+
+namespace ppr
+{
+
+static std::uint64_t zigzag(std::int64_t v)
+{
+  return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+static std::int64_t unzigzag(std::uint64_t v)
+{
+  return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
+
+static std::uint64_t get(std::span<std::uint8_t const> in, std::size_t& pos)
+{
+  std::uint64_t v = 0;
+  for (int shift = 0; pos < in.size() && shift < 64; shift += 7)
+  {
+    auto b = in[pos++];
+    v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      break;
+  }
+  return v;
+}
+
+void source_map::put(std::uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    table.push_back(static_cast<std::uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  table.push_back(static_cast<std::uint8_t>(v));
+}
+
+void source_map::put_segment(std::uint8_t flags, std::int32_t offset, std::int32_t line, std::uint32_t name)
+{
+  if (new_source)
+  {
+    flags |= next_source;
+    seg_offset = 0;
+    seg_line   = 0;
+    new_source = false;
+  }
+  put((static_cast<std::uint64_t>(out - seg_out) << 3) | flags);
+  put(zigzag(static_cast<std::int64_t>(offset) - seg_offset));
+  put(zigzag(static_cast<std::int64_t>(line) - seg_line));
+  if (flags & expanded)
+  {
+    put(name);
+    // First use of the name
+    if (name == written_names)
+    {
+      auto const& text = names[name];
+      put(text.size());
+      table.insert(table.end(), text.begin(), text.end());
+      written_names++;
+    }
+  }
+  seg_out    = out;
+  seg_offset = offset;
+  seg_line   = line;
+  seg_name   = name;
+  seg_flags  = flags & ~next_source;
+  segments   = true;
+}
+
+void source_map::add_source(std::size_t length, std::int32_t offset, std::int32_t line)
+{
+  if (!length)
+    return;
+  bool contiguous = segments && !new_source && seg_flags == passthrough && seg_line == line &&
+                    static_cast<std::int64_t>(offset) - seg_offset == static_cast<std::int64_t>(out - seg_out);
+  if (!contiguous)
+    put_segment(passthrough, offset, line);
+  out += length;
+}
+
+void source_map::add_expanded(std::size_t length, std::string_view macro, std::int32_t offset, std::int32_t line)
+{
+  if (!length)
+    return;
+  bool same = segments && !new_source && seg_flags == expanded && seg_offset == offset && seg_line == line &&
+              names[seg_name] == macro;
+  if (!same)
+  {
+    auto it = name_index.find(macro);
+    if (it == name_index.end())
+    {
+      it = name_index.emplace(std::string{macro}, static_cast<std::uint32_t>(names.size())).first;
+      names.emplace_back(macro);
+    }
+    put_segment(expanded, offset, line, it->second);
+  }
+  out += length;
+}
+
+void source_map::add_opaque(std::size_t length)
+{
+  if (!length)
+    return;
+  if (!segments || new_source || seg_flags != 0)
+    put_segment(0, new_source ? 0 : seg_offset, new_source ? 0 : seg_line);
+  out += length;
+}
+
+void source_map::begin_source()
+{
+  new_source = true;
+}
+
+bool source_map::find(std::size_t offset, location& l) const
+{
+  if (offset >= out)
+    return false;
+
+  std::size_t   pos    = 0;
+  std::size_t   at     = 0;
+  std::int64_t  src    = 0;
+  std::int64_t  line   = 0;
+  std::uint64_t name   = 0;
+  std::uint32_t source = 0;
+  std::uint8_t  flags  = 0;
+  std::uint32_t seen   = 0;
+  bool          first  = true;
+  while (pos < table.size())
+  {
+    auto head = get(table, pos);
+    if (at + (head >> 3) > offset)
+      break;
+    at += head >> 3;
+    flags = static_cast<std::uint8_t>(head & 7);
+    if (flags & next_source)
+    {
+      if (!first)
+        source++;
+      src  = 0;
+      line = 0;
+    }
+    first = false;
+    src += unzigzag(get(table, pos));
+    line += unzigzag(get(table, pos));
+    if (flags & expanded)
+    {
+      name = get(table, pos);
+      if (name == seen)
+      {
+        pos += get(table, pos);
+        seen++;
+      }
+    }
+  }
+
+  l.source = source;
+  l.offset = static_cast<std::int32_t>(src + ((flags & passthrough) ? static_cast<std::int64_t>(offset - at) : 0));
+  l.line   = static_cast<std::int32_t>(line);
+  l.macro  = (flags & expanded) ? std::string_view{names[name]} : std::string_view{};
+  return true;
+}
+
+void source_map::clear()
+{
+  table.clear();
+  names.clear();
+  name_index.clear();
+  out           = 0;
+  seg_out       = 0;
+  seg_offset    = 0;
+  seg_line      = 0;
+  seg_name      = 0;
+  seg_flags     = 0;
+  written_names = 0;
+  segments      = false;
+  new_source    = false;
+}
+
+} // namespace ppr
@@ -0,0 +1,359 @@
+
+#include "ppr_token_pipe.hpp"
+#include "ppr_sink.hpp"
+#include "ppr_tokenizer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace ppr
+{
+
+// Tokens published, and slots handed back, at a time
+static constexpr std::size_t batch = 256;
+// Smallest chunk picked for a source, smaller ones cost more in threads than they save
+static constexpr std::size_t min_chunk = 256 * 1024;
+
+struct token_pipe::chunk
+{
+  // Source range given to the chunk, the scan may run past `to`
+  std::int32_t              from = 0;
+  std::int32_t              to   = 0;
+  // Where the scan stopped, past a newline or at the end of the source, and the lines it counted
+  std::int32_t              end   = 0;
+  std::int32_t              lines = 0;
+  bool                      eof   = false;
+  std::vector<token>        tokens;
+  std::vector<error_record> errors;
+  std::atomic<bool>         ready{false};
+};
+
+// Keeps the errors of a scanner, with the number of tokens produced before each
+class token_pipe::error_log final : public sink
+{
+public:
+  error_log(token_pipe& p) : pipe(&p) {}
+  error_log(chunk& c) : target(&c) {}
+
+  void handle(token const&, symvalue const&) override {}
+
+  void error(std::string_view s, std::string_view e, ppr::token, ppr::loc l) override
+  {
+    if (pipe)
+      pipe->record_error({pipe->write, std::string{s}, std::string{e}, l});
+    else
+      target->errors.push_back({target->tokens.size(), std::string{s}, std::string{e}, l});
+  }
+
+private:
+  token_pipe* pipe   = nullptr;
+  chunk*      target = nullptr;
+};
+
+token_pipe::token_pipe(std::string_view src, bool elide, unsigned threads, std::size_t chunk_size,
+                       std::size_t capacity)
+    : source(src), elide_comments(elide)
+{
+  std::size_t size = batch;
+  while (size < capacity)
+    size <<= 1;
+  ring.reset(new token[size]);
+  mask  = size - 1;
+  limit = size;
+
+  if (threads > 1)
+  {
+    if (!chunk_size)
+      chunk_size = std::max(source.size() / (threads * 4), min_chunk);
+    // Chunks start after a newline
+    std::int32_t from = 0;
+    while (static_cast<std::size_t>(from) < source.size())
+    {
+      auto to = source.size();
+      if (from + chunk_size < source.size())
+      {
+        auto nl = static_cast<char const*>(
+            std::memchr(source.data() + from + chunk_size, '\n', source.size() - from - chunk_size));
+        if (nl)
+          to = static_cast<std::size_t>(nl - source.data()) + 1;
+      }
+      auto& c = chunks.emplace_back(std::make_unique<chunk>());
+      c->from = from;
+      c->to   = static_cast<std::int32_t>(to);
+      from    = c->to;
+    }
+    if (chunks.size() > 1)
+    {
+      window = threads * 2;
+      threads = std::min<unsigned>(threads, static_cast<unsigned>(chunks.size()));
+      for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back([this] { work(); });
+    }
+    else
+      chunks.clear();
+  }
+  producer = std::thread([this] { produce(); });
+}
+
+token_pipe::~token_pipe()
+{
+  // Wake a producer waiting on a full ring, and workers waiting for the join to catch up
+  stop.store(true, std::memory_order_release);
+  head.fetch_add(1, std::memory_order_release);
+  head.notify_one();
+  joined.fetch_add(window, std::memory_order_release);
+  joined.notify_all();
+  producer.join();
+  for (auto& w : workers)
+    w.join();
+}
+
+void token_pipe::record_error(error_record e)
+{
+  std::lock_guard lock(errors_lock);
+  errors.push_back(std::move(e));
+  error_count.store(errors.size(), std::memory_order_release);
+}
+
+void token_pipe::publish()
+{
+  tail.store(write, std::memory_order_release);
+  tail.notify_one();
+}
+
+bool token_pipe::push(token const& t)
+{
+  if (write == limit)
+  {
+    publish();
+    auto h = head.load(std::memory_order_acquire);
+    while (h + mask + 1 == write && !stop.load(std::memory_order_acquire))
+    {
+      head.wait(h, std::memory_order_acquire);
+      h = head.load(std::memory_order_acquire);
+    }
+    if (stop.load(std::memory_order_acquire))
+      return false;
+    limit = h + mask + 1;
+  }
+  ring[write & mask] = t;
+  ++write;
+  if (t.type == token_type::ty_eof || !(write % batch))
+  {
+    publish();
+    return !stop.load(std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void token_pipe::produce()
+{
+  if (!chunks.empty())
+  {
+    join_chunks();
+    return;
+  }
+
+  error_log log(*this);
+  tokenizer tk(source, log, std::pmr::new_delete_resource());
+  tk.set_elide_comments(elide_comments);
+  while (true)
+  {
+    auto t = tk.get();
+    if (!push(t) || t.type == token_type::ty_eof)
+      return;
+  }
+}
+
+void token_pipe::scan_chunk(chunk& c, std::int32_t from, std::int32_t to)
+{
+  error_log log(c);
+  tokenizer tk(source.substr(static_cast<std::size_t>(from)), log, std::pmr::new_delete_resource());
+  tk.set_elide_comments(elide_comments);
+  c.tokens.clear();
+  c.errors.clear();
+  c.tokens.reserve(static_cast<std::size_t>(std::max(to - from, 0)) / 4);
+  c.end = static_cast<std::int32_t>(source.size());
+  c.eof = false;
+  while (true)
+  {
+    auto t = tk.get();
+    if (t.type == token_type::ty_eof)
+    {
+      c.eof = true;
+      break;
+    }
+    t.value.td.start += from;
+    auto& kept = c.tokens.emplace_back(t);
+    if (kept.type == token_type::ty_newline && kept.value.td.start + 1 >= to)
+    {
+      c.end = kept.value.td.start + 1;
+      break;
+    }
+  }
+  c.lines = tk.get_loc().line;
+}
+
+void token_pipe::work()
+{
+  while (true)
+  {
+    auto k = next_chunk.fetch_add(1, std::memory_order_relaxed);
+    if (k >= chunks.size())
+      return;
+    auto j = joined.load(std::memory_order_acquire);
+    while (k >= j + window && !stop.load(std::memory_order_acquire))
+    {
+      joined.wait(j, std::memory_order_acquire);
+      j = joined.load(std::memory_order_acquire);
+    }
+    // Once stopped, chunks are handed over empty, the producer may be waiting on any of them
+    auto& c = *chunks[k];
+    if (!stop.load(std::memory_order_acquire))
+      scan_chunk(c, c.from, c.to);
+    c.ready.store(true, std::memory_order_release);
+    c.ready.notify_one();
+  }
+}
+
+void token_pipe::join_chunks()
+{
+  std::int32_t pos  = 0;
+  std::int32_t line = 0;
+  bool         eof  = false;
+  chunk        again;
+  for (std::size_t k = 0; k < chunks.size() && !eof; ++k)
+  {
+    auto& c = *chunks[k];
+    while (!c.ready.load(std::memory_order_acquire))
+    {
+      if (stop.load(std::memory_order_acquire))
+        return;
+      c.ready.wait(false, std::memory_order_acquire);
+    }
+    if (stop.load(std::memory_order_acquire))
+      return;
+
+    chunk*       use   = &c;
+    std::size_t  first = 0;
+    std::int32_t base  = line;
+    if (pos >= c.to)
+      use = nullptr;
+    else if (pos != c.from)
+    {
+      // The previous chunk ran on past the start of this one, look for the newline it stopped after
+      auto at = std::lower_bound(c.tokens.begin(), c.tokens.end(), pos - 1,
+                                 [](token const& t, std::int32_t p) { return t.value.td.start < p; });
+      if (at != c.tokens.end() && at->value.td.start == pos - 1 && at->type == token_type::ty_newline)
+      {
+        first = static_cast<std::size_t>(at - c.tokens.begin()) + 1;
+        base  = line - at->value.td.pos.line;
+      }
+      else
+      {
+        scan_chunk(again, pos, c.to);
+        use = &again;
+      }
+    }
+
+    if (use)
+    {
+      auto e = std::lower_bound(use->errors.begin(), use->errors.end(), first,
+                                [](error_record const& r, std::size_t i) { return r.index < i; });
+      for (auto i = first; i < use->tokens.size(); ++i)
+      {
+        for (; e != use->errors.end() && e->index <= i; ++e)
+        {
+          e->index = write;
+          record_error(std::move(*e));
+        }
+        auto t = use->tokens[i];
+        t.value.td.pos.line += base;
+        if (!push(t))
+          return;
+      }
+      pos  = use->end;
+      line = base + use->lines;
+      eof  = use->eof;
+    }
+
+    // Done with the chunk, let the workers move on
+    c.tokens = {};
+    c.errors = {};
+    joined.fetch_add(1, std::memory_order_release);
+    joined.notify_all();
+  }
+  push(token{});
+}
+
+void token_pipe::wait_for_tokens()
+{
+  // Everything read so far is free again
+  head.store(read, std::memory_order_release);
+  head.notify_one();
+  auto t = tail.load(std::memory_order_acquire);
+  while (t == read)
+  {
+    tail.wait(t, std::memory_order_acquire);
+    t = tail.load(std::memory_order_acquire);
+  }
+  available = t;
+}
+
+void token_pipe::consumed()
+{
+  if (!(++read % batch))
+  {
+    head.store(read, std::memory_order_release);
+    head.notify_one();
+  }
+}
+
+void token_pipe::deliver_errors(sink& to)
+{
+  std::lock_guard lock(errors_lock);
+  for (; delivered < errors.size() && errors[delivered].index <= read; ++delivered)
+  {
+    auto const& e = errors[delivered];
+    to.error(e.message, e.what, {}, e.location);
+  }
+}
+
+token token_pipe::next(sink& to)
+{
+  if (finished)
+    return end_token;
+  if (read == available)
+    wait_for_tokens();
+  if (error_count.load(std::memory_order_acquire) > delivered)
+    deliver_errors(to);
+  token t = ring[read & mask];
+  consumed();
+  if (t.type == token_type::ty_eof)
+  {
+    finished  = true;
+    end_token = t;
+  }
+  return t;
+}
+
+void token_pipe::skip_to(std::int32_t offset)
+{
+  while (!finished)
+  {
+    if (read == available)
+      wait_for_tokens();
+    auto const& t = ring[read & mask];
+    if (t.type == token_type::ty_eof || t.value.td.start >= offset)
+      break;
+    consumed();
+  }
+  // Errors on the skipped text are dropped, the tokenizer would not have scanned it
+  if (error_count.load(std::memory_order_acquire) > delivered)
+  {
+    std::lock_guard lock(errors_lock);
+    while (delivered < errors.size() && errors[delivered].index < read)
+      ++delivered;
+  }
+}
+
+} // namespace ppr
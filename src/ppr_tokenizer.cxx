@@ -2,6 +2,7 @@
 #include <iostream>
 #include "ppr_tokenizer.hpp"
 #include "ppr_sink.hpp"
+#include "ppr_token_pipe.hpp"
 
 extern ppr::token ppr_tokenize(ppr::tokenizer& ctx, void* yyscanner);
 
@@ -10,12 +11,19 @@ namespace ppr
 
 void tokenizer::push_error(std::string_view error) 
 {
-  reporter.error(error, "", {}, location);
+  reporter->error(error, "", {}, location);
 }
 
 void tokenizer::push_error(std::string_view error, std::string_view what) 
 {
-  reporter.error(error, what, {}, location);
+  reporter->error(error, what, {}, location);
+}
+
+void tokenizer::unmatched(int len)
+{
+  push_error("unexpected character",
+             content.substr(static_cast<std::size_t>(pos_commit), static_cast<std::size_t>(len)));
+  elide(len);
 }
 
 token tokenizer::get()
@@ -25,13 +33,13 @@ token tokenizer::get()
     ahead = false;
     return lookahead;
   }
-  return ppr_tokenize(*this, token_scanner);
+  return pipe ? pipe->next(*reporter) : ppr_tokenize(*this, token_scanner);
 }
 
 token tokenizer::peek() 
 {
   if (!ahead)
-    lookahead = ppr_tokenize(*this, token_scanner);
+    lookahead = pipe ? pipe->next(*reporter) : ppr_tokenize(*this, token_scanner);
   ahead     = true;
   return lookahead;
 }
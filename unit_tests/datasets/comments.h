@@ -0,0 +1,43 @@
+/*
+ * Licensed under the terms described in LICENSE, line 0 of the header block.
+ * Licensed under the terms described in LICENSE, line 1 of the header block.
+ * Licensed under the terms described in LICENSE, line 2 of the header block.
+ * Licensed under the terms described in LICENSE, line 3 of the header block.
+ * Licensed under the terms described in LICENSE, line 4 of the header block.
+ * Licensed under the terms described in LICENSE, line 5 of the header block.
+ * Licensed under the terms described in LICENSE, line 6 of the header block.
+ * Licensed under the terms described in LICENSE, line 7 of the header block.
+ * Licensed under the terms described in LICENSE, line 8 of the header block.
+ * Licensed under the terms described in LICENSE, line 9 of the header block.
+ * Licensed under the terms described in LICENSE, line 10 of the header block.
+ * Licensed under the terms described in LICENSE, line 11 of the header block.
+ */
+#version 450
+/**/int a;/*/ still a comment */int b;
+int c/**/= 1; int d /* x */ = 2;
+/* two
+   lines */ int e = 3;
+#define F(x) /* arg */ (x) // trailing
+#if defined(F) /* condition */ && 1
+int f = F(4); /* after */ // and more
+#else
+int g; /* disabled */
+#endif
+/* mid-line */ #define NOT_A_DIRECTIVE
+int h = 5; /*** stars ***/ int i = 6;
+/*
+ * Licensed under the terms described in LICENSE, line 0 of the header block.
+ * Licensed under the terms described in LICENSE, line 1 of the header block.
+ * Licensed under the terms described in LICENSE, line 2 of the header block.
+ * Licensed under the terms described in LICENSE, line 3 of the header block.
+ * Licensed under the terms described in LICENSE, line 4 of the header block.
+ * Licensed under the terms described in LICENSE, line 5 of the header block.
+ * Licensed under the terms described in LICENSE, line 6 of the header block.
+ * Licensed under the terms described in LICENSE, line 7 of the header block.
+ * Licensed under the terms described in LICENSE, line 8 of the header block.
+ * Licensed under the terms described in LICENSE, line 9 of the header block.
+ * Licensed under the terms described in LICENSE, line 10 of the header block.
+ * Licensed under the terms described in LICENSE, line 11 of the header block.
+ */
+int j = F(7);
+/* unterminated
@@ -0,0 +1,36 @@
+#define A0 16
+#define A1 A0
+#define A2 A1
+#define MAX_LIGHTS A2
+// comment line
+/* block
+   comment */
+#define PACK(x, n) ((x) << n) | A1
+#define CAT(a, b) a##b
+#define NOARG() 42
+int lights[MAX_LIGHTS];
+int p = PACK(v, 8) + PACK(v, 8) + PACK(w, MAX_LIGHTS);
+int c = CAT(foo, bar) + NOARG();
+#if MAX_LIGHTS > 8
+int big;
+#else
+int small;
+#endif
+#undef A0
+#define A0 32
+int l2[MAX_LIGHTS];
+#if defined(A0) && A0 == 32
+int thirtytwo;
+#elif 1
+int other;
+#endif
+#ifdef NOPE
+int nope; /* hidden */
+#endif
+#pragma once
+#version 450
+void main() { gl_Position = vec4(PACK(1, 2)); }
+#if A0 < 8 && defined(A1)
+int tiny;
+#endif
+int end;
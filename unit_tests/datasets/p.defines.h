@@ -0,0 +1,22 @@
+#define CONT 1 + \
+  2
+#define CMT /* spans
+ lines */ 3
+#define STR "a // not comment \" x" 4
+#define CH 'x' 5
+#define LC 6 // trailing \
+int after_lc = LC;
+#define FN(a, b) a + b /* c
+ */ * CONT
+int a = CONT;
+int b = CMT;
+int c = STR;
+int d = CH;
+int e = FN(1, 2);
+int f = LC;
+  #  define IND  7
+int g = IND;
+#define EMPTY
+int h = EMPTY 8;
+#define SELF_CALL FN(CONT, IND)
+int i = SELF_CALL;
@@ -0,0 +1,24 @@
+#define A0 16
+#define MAX_LIGHTS A0
+int lights[MAX_LIGHTS];
+#if MAX_LIGHTS > 8
+int big;
+#else
+int small; // kept verbatim
+  #if 1
+  int nested;
+  #endif
+#endif
+#ifdef NOPE
+int nope; // hidden
+#elif MAX_LIGHTS == 16
+int sixteen;
+#else
+int other;
+#endif
+#undef A0
+#ifndef A0
+int no_a0;
+#endif
+#if 0
+unterminated
@@ -0,0 +1,12 @@
+
+#version 450
+int a;int b;
+int c= 1; int d = 2;
+ int e = 3;
+#define F(x) (x)
+int f = F(4);
+
+ #define NOT_A_DIRECTIVE
+int h = 5; int i = 6;
+
+int j = F(7);
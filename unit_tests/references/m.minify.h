@@ -0,0 +1,9 @@
+#version 450 core
+#define SCALE 2
+#define MUL(a,b)((a)*(b))
+layout(location=0)in vec4 position;layout(location=0)out vec4 color;const float scale=float(SCALE);int count(int a,int b){int r=a+ +b- -a;r<<=1;r=r/2;r=r+b;return r>=0&&r!=1?r:-r;}void main(){float x=1.0*.5;float y=1.+ 2.;int i=0x10+010;color=vec4(position.xyz*scale,MUL(x,y));
+#pragma optimize(off)
+if(i>0)color.x=0.;}
+#define ONE (1)
+#define PAIR(x)(x,x)
+int one=ONE;
\ No newline at end of file
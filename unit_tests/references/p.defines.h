@@ -0,0 +1,10 @@
+int after_lc = 6;
+int a = 1 +  2;
+int b = 3;
+int c = "a // not comment \" x" 4;
+int d = 'x' 5;
+int e =1 + 2 * 1 +  2;
+int f = 6;
+int g =  7;
+int h = 8;
+int i = 1 +  2 +  7 * 1 +  2;
@@ -0,0 +1,13 @@
+
+
+int lights[ 16];
+int p = ((v) << 8) | 16 + ((v) << 8) | 16 + ((w) << 16) | 16;
+int c =foobar + 42;
+int big;
+
+int l2[ 32];
+int thirtytwo;
+
+#pragma once
+#version 450
+void main() { gl_Position = vec4( ((1) << 2) | 32); }
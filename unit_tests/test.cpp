@@ -1,20 +1,30 @@
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <ranges>
 #include <sstream>
+#include <thread>
 #include <string>
 #include <filesystem>
 
 #define PPR_IMPLEMENT
 #include <ppr.hpp>
 
-class sink_adapter : public ppr::sink
+// Base is ppr::sink for virtual dispatch, or ppr::basic_sink for use with ppr::basic_transform
+template <typename Base>
+class basic_sink_adapter : public Base
 {
   std::ostream& out;
 
 public:
-  sink_adapter(std::ostream& sout) : out(sout) {}
-  void handle(ppr::token const& t, symvalue const& data) override
+  basic_sink_adapter(std::ostream& sout) : out(sout) {}
+  void handle(ppr::token const& t, typename Base::symvalue const& data)
   {
     if (t.was_disabled ^ last_disabled)
     {
@@ -28,7 +38,7 @@ public:
     out << data.first << data.second;
   }
 
-  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l)
   {
     out << "error : " << s << " - " << e << "l(" << l.line << ":" << l.column << ")" << std::endl;
   }
@@ -37,10 +47,58 @@ private:
   bool last_disabled = false;
 };
 
+using sink_adapter   = basic_sink_adapter<ppr::sink>;
+using static_adapter = basic_sink_adapter<ppr::basic_sink>;
+
+// Same output written from batches, a small capacity splits longer lines
+class batch_adapter : public ppr::batch_sink
+{
+public:
+  batch_adapter(std::ostream& sout) : ppr::batch_sink(7), printer(sout) {}
+
+  void handle_batch(std::span<ppr::token const> tokens, std::span<symvalue const> values) override
+  {
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+      printer.handle(tokens[i], values[i]);
+  }
+
+  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  {
+    flush();
+    printer.error(s, e, t, l);
+  }
+
+private:
+  static_adapter printer;
+};
+
+// Same output written from merged source ranges
+class range_adapter : public ppr::range_sink
+{
+public:
+  range_adapter(std::ostream& sout) : printer(sout) {}
+
+  void handle_range(std::string_view text, bool disabled) override
+  {
+    ppr::token t;
+    t.was_disabled = disabled;
+    printer.handle(t, {std::string_view{}, text});
+  }
+
+  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  {
+    flush();
+    printer.error(s, e, t, l);
+  }
+
+private:
+  static_adapter printer;
+};
+
 
-bool compare_expected(std::string const& name)
+bool compare_expected(std::string const& name, std::string const& output)
 {
-  std::ifstream f1("./output/" + name);
+  std::ifstream f1("./output/" + output);
   std::ifstream f2("./references/" + name);
 
   if (f1.fail() || f2.fail())
@@ -53,6 +111,875 @@ bool compare_expected(std::string const& name)
   return f1_str == f2_str;
 }
 
+// Sets every option, batch workers reuse a transform from one dataset to the next
+template <typename Sink>
+void configure(ppr::basic_transform<Sink>& ctx, std::string const& name)
+{
+  bool code     = name.starts_with("p.");
+  bool disabled = name.starts_with("d.");
+  bool ranges   = name.starts_with("r.");
+  ctx.set_transform_code(code);
+  ctx.set_call_cache_limit(code ? 1 << 20 : 0);
+  ctx.set_ignore_disabled(!disabled && !ranges);
+  ctx.set_minify(name.starts_with("m."));
+  ctx.set_disabled_ranges(ranges);
+}
+
+template <typename Sink>
+void preprocess(std::string const& name, std::string_view content, std::string const& out_file)
+{
+  std::ofstream              out(out_file);
+  Sink                       adapter(out);
+  ppr::basic_transform<Sink> ctx(adapter);
+  configure(ctx, name);
+  ctx.preprocess(content);
+}
+
+// Same output pulled through transform::tokens, which leaves out minify and disabled ranges
+void preprocess_pulled(std::string const& name, std::string_view content, std::string const& out_file)
+{
+  std::ofstream  out(out_file);
+  sink_adapter   printer(out);
+  ppr::transform ctx(printer);
+  configure(ctx, name);
+  for (auto const& t : ctx.tokens(content))
+    printer.handle(t.tok, {t.space, t.text});
+}
+
+static_assert(std::ranges::input_range<ppr::transform::token_range>);
+
+// A range dropped part way leaves the transform usable, with the definitions read so far
+bool pull_early_stop()
+{
+  std::ostringstream out;
+  sink_adapter       printer(out);
+  ppr::transform     ctx(printer);
+  ctx.set_transform_code(true);
+  {
+    auto range = ctx.tokens("#define A 1\nA B\n#define C 2\n");
+    auto it    = range.begin();
+    while (it != range.end() && it->text != "B")
+      ++it;
+    if (it == range.end())
+      return false;
+  }
+  ctx.preprocess("A C\n");
+  return out.str() == " 1 C\n";
+}
+
+using pmr_strings = ppr::small_vector<std::string, 2, std::pmr::polymorphic_allocator<std::string>>;
+static_assert(std::is_nothrow_move_assignable_v<ppr::small_vector<std::string, 2>>);
+// Unequal memory resources make a move assignment allocate
+static_assert(!std::is_nothrow_move_assignable_v<pmr_strings>);
+
+// Copies and moves, between unequal allocators too, shrinking back inline and growing with an element of
+// its own
+bool small_vector_ops()
+{
+  // Longer than a string keeps inline, so a bad relocation shows
+  auto text  = [](int i) { return std::string(40, static_cast<char>('a' + i)); };
+  auto holds = [&](pmr_strings const& v, std::size_t n)
+  {
+    if (v.size() != n)
+      return false;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      if (v[i] != text(static_cast<int>(i)))
+        return false;
+    }
+    return true;
+  };
+  auto is_inline = [](pmr_strings const& v)
+  {
+    auto p = reinterpret_cast<char const*>(v.data());
+    auto o = reinterpret_cast<char const*>(&v);
+    return p >= o && p < o + sizeof(v);
+  };
+
+  std::pmr::monotonic_buffer_resource r1, r2;
+  pmr_strings                         a{&r1};
+  for (int i = 0; i < 5; ++i)
+    a.push_back(text(i));
+  // A copy gets the default resource, as for std::pmr containers, and the move takes it along
+  pmr_strings copy(a);
+  pmr_strings moved(std::move(copy));
+  if (!holds(a, 5) || !copy.empty() || !holds(moved, 5) ||
+      moved.get_allocator().resource() != std::pmr::get_default_resource())
+    return false;
+  pmr_strings small{&r1};
+  small.push_back(text(0));
+  pmr_strings small_moved(std::move(small));
+  if (!small.empty() || !holds(small_moved, 1) || !is_inline(small_moved))
+    return false;
+
+  // Nothing handed over between the resources, the elements are moved into memory of r2
+  pmr_strings other{&r2};
+  other.push_back(text(7));
+  other = std::move(moved);
+  if (!moved.empty() || !holds(other, 5) || other.get_allocator().resource() != &r2)
+    return false;
+  pmr_strings assigned{&r2};
+  assigned = a;
+  if (!holds(assigned, 5) || !holds(a, 5))
+    return false;
+
+  while (other.size() > 2)
+    other.pop_back();
+  other.shrink_to_fit();
+  if (other.capacity() != 2 || !is_inline(other) || !holds(other, 2))
+    return false;
+
+  pmr_strings grow{&r1};
+  grow.push_back(text(0));
+  grow.push_back(text(1));
+  grow.emplace_back(grow[0]);
+  if (is_inline(grow) || grow.size() != 3 || grow[2] != text(0))
+    return false;
+  while (grow.size() < grow.capacity())
+    grow.push_back(text(1));
+  grow.push_back(std::move(grow[1]));
+  return grow.size() == 5 && grow[4] == text(1) && grow[0] == text(0) && grow[2] == text(0);
+}
+
+// A repeated call is expanded once and replayed, a limit that holds one entry drops the cache to make room
+bool call_cache()
+{
+  std::ostringstream expected, out;
+  sink_adapter       plain_printer(expected), printer(out);
+  ppr::transform     plain(plain_printer), ctx(printer);
+  for (auto* t : {&plain, &ctx})
+  {
+    t->set_transform_code(true);
+    t->preprocess("#define F(x, y) x + y * 2\n");
+  }
+  expected.str({});
+  plain.preprocess("F(a, 1) F(a, 1) F(a,1)\n");
+
+  ctx.set_call_cache_limit(1 << 20);
+  out.str({});
+  ctx.preprocess("F(a, 1) F(a, 1)");
+  auto const& stats = ctx.get_call_cache_stats();
+  auto one = stats.bytes;
+  if (stats.misses != 1 || stats.hits != 1 || !one)
+    return false;
+  // Spacing inside the arguments is part of the call
+  ctx.preprocess(" F(a,1)\n");
+  if (out.str() != expected.str() || stats.misses != 2 || stats.hits != 1)
+    return false;
+
+  ctx.set_call_cache_limit(one + one / 2);
+  if (stats.bytes)
+    return false;
+  ctx.preprocess("F(a, 1) F(b, 1) F(a, 1) F(a, 1)\n");
+  if (stats.misses != 5 || stats.hits != 2 || stats.bytes != one)
+    return false;
+  ctx.set_call_cache_limit(one - 1);
+  ctx.preprocess("F(a, 1) F(a, 1)\n");
+  return stats.misses == 7 && stats.hits == 2 && !stats.bytes;
+}
+
+// Errors raised inside a recorded expansion come out between the same tokens as without a cache
+bool cached_call_errors()
+{
+  std::string_view const defs   = "#define G(x) x\n#define F(x) x + G(x, x) + 1\n#define O b - G(1, 2)\n";
+  std::string_view const source = "int i = F(a);\nint j = O;\n";
+  std::ostringstream     expected, out;
+  sink_adapter           plain_printer(expected), printer(out);
+  ppr::transform         plain(plain_printer), ctx(printer);
+  ctx.set_call_cache_limit(1 << 20);
+  for (auto* t : {&plain, &ctx})
+  {
+    t->set_transform_code(true);
+    t->preprocess(defs);
+  }
+  expected.str({});
+  out.str({});
+  plain.set_call_cache_limit(0);
+  for (auto line : {source.substr(0, 14), source.substr(14)})
+  {
+    plain.preprocess(line);
+    ctx.preprocess(line);
+  }
+  return out.str() == expected.str() && out.str().find("error") != std::string::npos;
+}
+
+// A reset after an unterminated #if starts clean, with or without the definitions
+bool transform_reset()
+{
+  std::ostringstream out;
+  sink_adapter       printer(out);
+  ppr::transform     ctx(printer);
+  ctx.set_transform_code(true);
+  ctx.preprocess("#define A 1\n#if 0\n");
+  ctx.reset(ppr::reset_mode::keep_macros);
+  out.str({});
+  ctx.preprocess("A\n");
+  if (out.str() != " 1\n")
+    return false;
+  ctx.reset();
+  out.str({});
+  ctx.preprocess("A\n");
+  return out.str() == "A\n";
+}
+
+// Definitions made through the API preprocess a source as the same #define and #undef lines would
+bool define_api()
+{
+  std::pair<std::string_view, std::string_view> const defs[] = {{"A", "1"}, {"B", "(A + 2)"}, {"E", ""}, {"U", "3"}};
+  std::string_view const params[] = {"x", "y"};
+  std::string_view const source   = "#if A && defined(E)\nint a = B*F(A, U);\n#endif\nE U;\n";
+  for (bool code : {true, false})
+  {
+    for (bool lazy : {true, false})
+    {
+      std::ostringstream expected, out;
+      sink_adapter       text_printer(expected), api_printer(out);
+      ppr::transform     text(text_printer), api(api_printer);
+      for (auto* ctx : {&text, &api})
+      {
+        ctx->set_transform_code(code);
+        ctx->set_lazy_defines(lazy);
+      }
+      text.preprocess("#define A 1\n#define B (A + 2)\n#define E\n#define U 3\n#define F(x, y) x##y + y\n#undef U\n");
+      expected.str({});
+      text.preprocess(source);
+
+      if (api.define_all(defs) != 4 || !api.define_function("F", params, "x##y + y") || !api.undefine("U"))
+        return false;
+      if (api.define("A", "2") || api.define("1A") || api.undefine("Z"))
+        return false;
+      api.preprocess(source);
+      if (out.str() != expected.str())
+        return false;
+    }
+  }
+  return true;
+}
+
+// Transforms on several threads share a frozen environment, their own defines and undefs stay local
+bool shared_environment()
+{
+  std::ostringstream base_out;
+  sink_adapter       base_printer(base_out);
+  ppr::transform     base(base_printer);
+  base.set_transform_code(true);
+  base.preprocess("#define A 1\n#define F(x) x + A\n#define B 2\n");
+  auto env = base.freeze();
+
+  std::string              results[4];
+  std::vector<std::thread> jobs;
+  for (auto& r : results)
+  {
+    jobs.emplace_back(
+        [&env, &r]
+        {
+          std::ostringstream out;
+          sink_adapter       printer(out);
+          ppr::transform     ctx(printer);
+          ctx.set_transform_code(true);
+          ctx.set_environment(env);
+          for (int i = 0; i < 100; ++i)
+            ctx.preprocess("A F(B)\n");
+          out.str({});
+          ctx.preprocess("#undef B\n#define C 3\n#define A 4\nA F(C) B\n");
+          r = out.str();
+        });
+  }
+  for (auto& j : jobs)
+    j.join();
+
+  std::ostringstream out;
+  sink_adapter       printer(out);
+  ppr::transform     ctx(printer);
+  ctx.set_transform_code(true);
+  ctx.set_environment(env);
+  ctx.preprocess("A F(B) C\n");
+  // A stays as shared, B is hidden, C is only defined by the jobs
+  for (auto const& r : results)
+  {
+    if (r != "\n 1 3 + 1 B\n")
+      return false;
+  }
+  if (out.str() != " 1 2 + 1 C\n")
+    return false;
+  base_out.str({});
+  base.preprocess("A F(B) C\n");
+  return base_out.str() == out.str();
+}
+
+// All datasets at once through ppr::batch, each job writing its own file
+bool batch_all(unsigned threads)
+{
+  namespace fs = std::filesystem;
+  std::vector<std::string>        names;
+  std::vector<ppr::mapped_source> sources;
+  for (auto& p : fs::directory_iterator("./datasets"))
+  {
+    names.push_back(p.path().filename().generic_string());
+    sources.emplace_back(p.path().string());
+  }
+
+  {
+    std::deque<std::ofstream>    files;
+    std::deque<sink_adapter>     adapters;
+    std::vector<ppr::batch::job> jobs;
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+      auto& out = files.emplace_back("./output/" + names[i] + ".jobs");
+      jobs.push_back({sources[i].view(), nullptr, &adapters.emplace_back(out)});
+    }
+    ppr::batch b(threads);
+    b.set_setup([&](ppr::transform& ctx, std::size_t i) { configure(ctx, names[i]); });
+    b.run(jobs);
+  }
+
+  for (auto const& name : names)
+  {
+    if (!compare_expected(name, name + ".jobs"))
+      return false;
+  }
+  return true;
+}
+
+// A job without an output is reported failed and done, the others run
+bool batch_null_output()
+{
+  std::ostringstream           out;
+  sink_adapter                 printer(out);
+  std::vector<ppr::batch::job> jobs = {{"#define A 1\nA\n", nullptr, nullptr}, {"B\n", nullptr, &printer}};
+  std::vector<char>            done(jobs.size(), 0);
+  ppr::batch                   b(2);
+  b.set_done([&](std::size_t i) { done[i] = 1; });
+  return b.run(jobs) == 1 && jobs[0].failed && !jobs[1].failed && done[0] && done[1] && out.str() == "B\n";
+}
+
+// Same output with the tokenizer running on its own thread
+void preprocess_pipelined(std::string const& name, std::string_view content, std::string const& out_file)
+{
+  std::ofstream  out(out_file);
+  sink_adapter   adapter(out);
+  ppr::transform ctx(adapter);
+  configure(ctx, name);
+  ctx.set_pipeline_threshold(1);
+  ctx.preprocess(content);
+}
+
+struct quiet_sink : ppr::sink
+{
+  void handle(ppr::token const&, symvalue const&) override {}
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override {}
+};
+
+bool same_token(ppr::token const& a, ppr::token const& b)
+{
+  if (a.type != b.type)
+    return false;
+  if (a.type == ppr::token_type::ty_eof)
+    return true;
+  return a.value.td.start == b.value.td.start && a.value.td.length == b.value.td.length &&
+         a.value.td.pos.line == b.value.td.pos.line && a.value.td.pos.column == b.value.td.pos.column &&
+         a.value.td.whitespaces == b.value.td.whitespaces;
+}
+
+// Counts the errors reported, drops the tokens
+struct error_counter : ppr::sink
+{
+  int errors = 0;
+
+  void handle(ppr::token const&, symvalue const&) override {}
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override
+  {
+    errors++;
+  }
+};
+
+// Null directives and line markers, as in preprocessor output, scan without errors and leave the next line
+// to the code
+bool null_directives()
+{
+  std::string_view const source = "#\nint a;\n# 1 \"file.h\" 2\n#42\nint b;\n  #  \r\nint c;\n#";
+  error_counter          counter;
+  ppr::tokenizer         tk(source, counter);
+  int                    idents = 0;
+  for (auto t = tk.get(); t.type != ppr::token_type::ty_eof; t = tk.get())
+  {
+    if (t.type == ppr::token_type::ty_preprocessor)
+      return false;
+    idents += t.type == ppr::token_type::ty_keyword_ident ? 1 : 0;
+  }
+  if (counter.errors || idents != 6)
+    return false;
+
+  std::ostringstream out;
+  sink_adapter       printer(out);
+  ppr::transform     ctx(printer);
+  ctx.preprocess(source);
+  return out.str().find("error") == std::string::npos && out.str().find("int b;") != std::string::npos;
+}
+
+// Tokens of a chunked, multi-threaded scan match a plain tokenizer's, at chunk sizes that put boundaries
+// inside comments, strings and continued lines
+bool chunked_scan(std::string_view content)
+{
+  quiet_sink errors;
+
+  for (bool elide : {true, false})
+  {
+    for (std::size_t chunk : {1, 7, 32})
+    {
+      ppr::tokenizer  plain(content, errors);
+      ppr::token_pipe pipe(content, elide, 3, chunk, 256);
+      plain.set_elide_comments(elide);
+      while (true)
+      {
+        auto t = plain.get();
+        if (!same_token(t, pipe.next(errors)))
+          return false;
+        if (t.type == ppr::token_type::ty_eof)
+          break;
+      }
+    }
+  }
+  return true;
+}
+
+// A chunked pipe dropped part way, with workers scanning, waiting on the join or done, does not hang
+bool chunked_drop(std::string_view content)
+{
+  quiet_sink errors;
+  for (std::size_t stop_at : {0, 1, 10, 100, 1000})
+  {
+    for (int i = 0; i < 20; ++i)
+    {
+      ppr::token_pipe pipe(content, true, 4, 16, 256);
+      for (std::size_t n = 0; n < stop_at && pipe.next(errors).type != ppr::token_type::ty_eof; ++n)
+        ;
+    }
+  }
+  return true;
+}
+
+// Passes allocations on to new/delete, keeping count of them
+class counting_resource final : public std::pmr::memory_resource
+{
+public:
+  std::size_t allocations = 0;
+  std::size_t outstanding = 0;
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t align) override
+  {
+    allocations++;
+    outstanding += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t align) override
+  {
+    outstanding -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+  }
+
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+// Counts the calls to the global operator new made on a thread while it is set
+thread_local bool count_heap     = false;
+thread_local std::size_t heap_calls = 0;
+
+void* operator new(std::size_t bytes)
+{
+  if (count_heap)
+    heap_calls++;
+  if (auto p = std::malloc(bytes ? bytes : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+// A transform given a memory resource allocates from it alone: pooled tokenizers, token streams, pulled token
+// ranges, macro storage and #if evaluation with its recorded text. The stack of the generated #if parser is
+// the one allocation left to the heap, once per evaluation.
+bool memory_resource_use()
+{
+  counting_resource mem, fallback;
+  auto              previous = std::pmr::set_default_resource(&fallback);
+  bool              ok       = true;
+  {
+    quiet_sink     errors;
+    ppr::transform ctx(errors, &mem);
+    ctx.set_transform_code(true);
+    ctx.set_ignore_disabled(false);
+    count_heap = true;
+    ctx.preprocess("#define A 1\n#define F(x) x + A\nF(A) F(2)\n");
+    for (auto const& t : ctx.tokens("#define G(y) F(y) * 2\nG(3)\n"))
+      ok = ok && !t.text.empty();
+    ok         = ok && heap_calls == 0 && mem.allocations > 0;
+    auto made  = mem.allocations;
+    ctx.preprocess("#if A > 2 && defined(F)\nF(2)\n#elif G(1) == 2\n#endif\n");
+    ok         = ok && ctx.eval_bool("F(1) == 2") && mem.allocations > made;
+    count_heap = false;
+    ok         = ok && heap_calls == 3;
+  }
+  std::pmr::set_default_resource(previous);
+  return ok && mem.outstanding == 0 && fallback.allocations == 0;
+}
+
+// Expansions recorded again after every #define keep to the memory of the first few, pasted text and
+// definitions from a shared environment included
+bool expansion_memory()
+{
+  std::string name(200, 'x');
+  auto        prelude = "#define P(a, b) a##b\n#define A P(" + name + ", " + name + ") B z\n";
+  // Outgrows the first blocks of the arena of A's expansion, which records it whole
+  std::string body;
+  while (body.size() < 4000)
+    body += "b + ";
+  auto source = "A\n#define B " + body + "1\nA\n#undef B\n";
+  for (bool shared : {false, true})
+  {
+    counting_resource mem;
+    quiet_sink        errors;
+    ppr::transform    ctx(errors, &mem);
+    ctx.set_transform_code(true);
+    ctx.preprocess(prelude);
+    if (shared)
+      ctx.freeze();
+    auto uses = [&](int n)
+    {
+      for (int i = 0; i < n; ++i)
+        ctx.preprocess(source);
+    };
+    uses(10);
+    auto settled = mem.outstanding;
+    uses(100);
+    if (mem.outstanding != settled)
+      return false;
+  }
+  return true;
+}
+
+// Redefining and undefining a macro over and over releases the text of the definitions it replaces
+bool definition_memory()
+{
+  std::string body;
+  while (body.size() < 4000)
+    body += "a + ";
+  body += "b";
+  auto source = "#define X " + body + "\nX\n#undef X\n";
+  for (bool shared : {false, true})
+  {
+    for (bool lazy : {true, false})
+    {
+      counting_resource mem;
+      quiet_sink        errors;
+      ppr::transform    ctx(errors, &mem);
+      ctx.set_transform_code(true);
+      ctx.set_lazy_defines(lazy);
+      // Over a shared definition, the #undef leaves a local one hiding it
+      ctx.preprocess("#define X 1\n#define Y 2\n");
+      if (shared)
+        ctx.freeze();
+      auto cycles = [&](int n)
+      {
+        for (int i = 0; i < n; ++i)
+        {
+          ctx.preprocess(source);
+          ctx.undefine("Y");
+          ctx.define("Y", body);
+        }
+      };
+      cycles(5);
+      auto settled = mem.outstanding;
+      cycles(50);
+      if (mem.outstanding != settled)
+        return false;
+    }
+  }
+  return true;
+}
+
+// A reset tokenizer, left expecting a directive name or at the end of a source, scans like a new one
+bool tokenizer_reset(std::string_view content)
+{
+  quiet_sink     errors;
+  ppr::tokenizer reused("x\n#", errors);
+  for (int i = 0; i < 3; ++i)
+    reused.get();
+  for (bool elide : {true, false})
+  {
+    reused.reset(content);
+    reused.set_elide_comments(elide);
+    ppr::tokenizer plain(content, errors);
+    plain.set_elide_comments(elide);
+    while (true)
+    {
+      auto t = plain.get();
+      if (!same_token(t, reused.get()))
+        return false;
+      if (t.type == ppr::token_type::ty_eof)
+        break;
+    }
+  }
+  return true;
+}
+
+// The environment hash follows the visible definitions, whichever way and in whatever order they were made
+bool environment_hash()
+{
+  quiet_sink errors;
+  auto       hash_of = [&](std::string_view prelude, bool lazy)
+  {
+    ppr::transform ctx(errors);
+    ctx.set_transform_code(true);
+    ctx.set_lazy_defines(lazy);
+    ctx.preprocess(prelude);
+    return ctx.environment_hash();
+  };
+
+  auto h = hash_of("#define A 1\n#define F(a,b) a+b\n", true);
+  if (!h || h != hash_of("#define F(a,b) a+b  \n#define A  1\n", false) ||
+      h != hash_of("#define A 1\n#define B 2\n#define F(a,b) a+b\n#undef B\n", true))
+    return false;
+  if (h == hash_of("#define A 2\n#define F(a,b) a+b\n", true) || h == hash_of("#define A 1\n#define F(a) a+b\n", true))
+    return false;
+
+  std::string_view const params[] = {"a", "b"};
+  ppr::transform         api(errors);
+  api.define("A", "1");
+  api.define_function("F", params, "a+b");
+  if (api.environment_hash() != h || api.fingerprint("A") != ppr::macro_fingerprint("A", false, "1") ||
+      api.fingerprint("B"))
+    return false;
+
+  ppr::transform base(errors), overlay(errors);
+  base.define("A", "1");
+  base.define("B", "2");
+  auto env = base.freeze();
+  overlay.set_environment(env);
+  overlay.undefine("B");
+  overlay.define_function("F", params, "a+b");
+  if (env->hash() != base.environment_hash() || overlay.environment_hash() != h)
+    return false;
+  overlay.reset();
+  if (overlay.environment_hash() != env->hash())
+    return false;
+
+  api.undefine("A");
+  api.undefine("F");
+  return api.environment_hash() == 0;
+}
+
+// Definitions made through the API hash as the #define lines they stand for, parsed lazily or not, and a
+// reset that clears the local definitions goes back to the shared environment's hash
+bool environment_hash_api()
+{
+  quiet_sink             errors;
+  std::string_view const params[] = {"a", "b"};
+  std::string_view const names[]  = {"A", "E", "F", "S"};
+  for (bool code : {true, false})
+  {
+    for (bool lazy : {true, false})
+    {
+      ppr::transform text(errors), api(errors);
+      for (auto* ctx : {&text, &api})
+      {
+        ctx->set_transform_code(code);
+        ctx->set_lazy_defines(lazy);
+      }
+      text.preprocess("#define A 1\n#define E\n#define F(a,b) a+b\n#define S \"x y\"\n");
+      api.define("A", "1");
+      api.define("E");
+      api.define_function("F", params, "a+b");
+      api.define("S", "\"x y\"");
+      if (!text.environment_hash() || text.environment_hash() != api.environment_hash())
+        return false;
+      for (auto n : names)
+      {
+        if (!text.fingerprint(n) || text.fingerprint(n) != api.fingerprint(n))
+          return false;
+      }
+
+      auto env = api.freeze();
+      text.reset();
+      text.set_environment(env);
+      text.preprocess("#define B 2\n#undef A\n");
+      if (text.environment_hash() == env->hash())
+        return false;
+      text.reset(ppr::reset_mode::keep_macros);
+      if (text.environment_hash() == env->hash())
+        return false;
+      text.reset(ppr::reset_mode::clear_macros);
+      if (text.environment_hash() != env->hash() || env->hash() != api.environment_hash())
+        return false;
+    }
+  }
+  return true;
+}
+
+// Errors share the descriptor with the output, a small buffer exercises partial and direct writes
+void preprocess_fd(std::string const& name, std::string const& path, std::string const& out_file)
+{
+  auto f = std::fopen(out_file.c_str(), "wb");
+  if (!f)
+    return;
+  {
+    ppr::fd_sink                       adapter(fileno(f), fileno(f), 16);
+    ppr::basic_transform<ppr::fd_sink> ctx(adapter);
+    configure(ctx, name);
+    ctx.preprocess_file(path);
+  }
+  std::fclose(f);
+}
+
+// Records what a sink receives, to check the binary stream against
+class record_adapter final : public ppr::basic_sink
+{
+public:
+  struct record
+  {
+    ppr::token_type     type;
+    ppr::operator2_type op2;
+    std::string         text;
+    bool                disabled;
+  };
+
+  void handle(ppr::token const& t, symvalue const& data)
+  {
+    bool rt   = t.type == ppr::token_type::ty_rtoken;
+    auto type = rt ? t.value.rt->type : t.type;
+    auto op2  = type != ppr::token_type::ty_operator2 ? ppr::operator2_type{} : rt ? t.value.rt->op2 : t.value.td.op2;
+    tokens.push_back({type, op2, std::string{data.second}, t.was_disabled});
+  }
+
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) {}
+
+  std::vector<record> tokens;
+};
+
+// Text of an integer read back as a value, written the way the stream format expects it was spelled
+std::string integer_spelling(ppr::binary_token const& t)
+{
+  int         base = t.type == ppr::token_type::ty_hex_integer ? 16 : t.type == ppr::token_type::ty_oct_integer ? 8 : 10;
+  std::string s    = t.negative ? "-" : "";
+  if (base == 16)
+    s += "0x";
+  else if (base == 8 && t.value)
+    s += "0";
+  char digits[24];
+  auto end = std::to_chars(digits, std::end(digits), t.value, base).ptr;
+  for (auto c = digits; c != end; ++c)
+    s += static_cast<char>(std::toupper(*c));
+  return s += t.text;
+}
+
+// Every token read back from the binary stream has the type, flags and text the sink saw, integers
+// spelled from their value and sign, operator2 tokens with their operator
+bool binary_roundtrip(std::string const& name, std::string_view content)
+{
+  record_adapter                       rec;
+  ppr::basic_transform<record_adapter> rctx(rec);
+  configure(rctx, name);
+  rctx.preprocess(content);
+
+  ppr::binary_sink                       bin(true);
+  ppr::basic_transform<ppr::binary_sink> bctx(bin);
+  configure(bctx, name);
+  bctx.preprocess(content);
+
+  ppr::binary_reader reader(bin.data());
+  ppr::binary_token  t;
+  std::size_t        i = 0;
+  while (reader.next(t))
+  {
+    if (i >= rec.tokens.size())
+      return false;
+    auto const& r = rec.tokens[i++];
+    if (t.type != r.type || t.disabled != r.disabled)
+      return false;
+    bool integer = t.type == ppr::token_type::ty_integer || t.type == ppr::token_type::ty_hex_integer ||
+                   t.type == ppr::token_type::ty_oct_integer;
+    if (t.verbatim || !(integer || t.type == ppr::token_type::ty_operator2))
+    {
+      // true, false and newline carry no text
+      bool bare = t.type == ppr::token_type::ty_true || t.type == ppr::token_type::ty_false ||
+                  t.type == ppr::token_type::ty_newline;
+      if (!bare && t.text != r.text)
+        return false;
+    }
+    else if (integer ? integer_spelling(t) != r.text : (t.op2 != r.op2 || !t.text.empty()))
+      return false;
+  }
+  return !reader.failed() && i == rec.tokens.size();
+}
+
+// Collects the output and where each token's text starts in it
+class output_adapter final : public ppr::basic_sink
+{
+public:
+  struct piece
+  {
+    std::size_t offset;
+    std::string text;
+    bool        source;
+  };
+
+  void handle(ppr::token const& t, symvalue const& data)
+  {
+    text += data.first;
+    bool source = t.type != ppr::token_type::ty_rtoken && t.type != ppr::token_type::ty_raw &&
+                  t.type != ppr::token_type::ty_true && t.type != ppr::token_type::ty_false;
+    pieces.push_back({text.size(), std::string{data.second}, source});
+    text += data.second;
+  }
+
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) {}
+
+  std::string        text;
+  std::vector<piece> pieces;
+};
+
+// Every token of the output maps back to its own text in the source, or to the call site of the macro that
+// produced it, on the line the source has it on
+bool source_map_check(std::string const& name, std::string_view content)
+{
+  output_adapter                       out;
+  ppr::source_map                      map;
+  ppr::basic_transform<output_adapter> ctx(out);
+  configure(ctx, name);
+  ctx.set_source_map(&map);
+  ctx.preprocess(content);
+
+  if (map.output_size() != out.text.size())
+    return false;
+  for (auto const& p : out.pieces)
+  {
+    if (p.text.empty())
+      continue;
+    ppr::source_map::location l;
+    if (!map.find(p.offset, l) || l.offset < 0 || static_cast<std::size_t>(l.offset) > content.size())
+      return false;
+    auto at = content.substr(static_cast<std::size_t>(l.offset));
+    if (!l.macro.empty() ? !at.starts_with(l.macro) : (p.source && !at.starts_with(p.text)))
+      return false;
+    if (std::count(content.begin(), content.begin() + l.offset, '\n') != l.line)
+      return false;
+  }
+  return true;
+}
+
 int main(int argc, char* argv[])
 {
   int fail     = 0;
@@ -66,30 +993,179 @@ int main(int argc, char* argv[])
     std::string out_file = "./output/";
     out_file += name;
 
-    {
-      std::ifstream src(path);
-      std::ofstream out(out_file);
-      sink_adapter adapter(out);
+    ppr::mapped_source source(path.string());
+    auto               content = source.view();
+    preprocess<sink_adapter>(name, content, out_file);
+    preprocess<static_adapter>(name, content, out_file + ".static");
+    preprocess<batch_adapter>(name, content, out_file + ".batch");
+    preprocess<range_adapter>(name, content, out_file + ".range");
+    preprocess_fd(name, path.string(), out_file + ".fd");
+    preprocess_pipelined(name, content, out_file + ".pipe");
+    bool pulled = !name.starts_with("m.") && !name.starts_with("r.");
+    if (pulled)
+      preprocess_pulled(name, content, out_file + ".pull");
 
-      sink_adapter sa(out);
-      ppr::transform ctx(adapter);
-      //ctx.set_transform_code(true);
-      if (name.starts_with("d."))
-        ctx.set_ignore_disabled(false);
- 
-      std::stringstream buffer;
-      buffer << src.rdbuf();
- 
-      std::string content = buffer.str();
-      ctx.preprocess(content);    
-    }
-
-    if (!compare_expected(name))
+    if (!compare_expected(name, name))
     {
       std::cout << "failed: " << name << std::endl;
       fail--;
     }
+    if (!compare_expected(name, name + ".static"))
+    {
+      std::cout << "failed (static sink): " << name << std::endl;
+      fail--;
+    }
+    if (!compare_expected(name, name + ".batch"))
+    {
+      std::cout << "failed (batch sink): " << name << std::endl;
+      fail--;
+    }
+    if (!compare_expected(name, name + ".range"))
+    {
+      std::cout << "failed (range sink): " << name << std::endl;
+      fail--;
+    }
+    if (!compare_expected(name, name + ".fd"))
+    {
+      std::cout << "failed (fd sink): " << name << std::endl;
+      fail--;
+    }
+    if (!compare_expected(name, name + ".pipe"))
+    {
+      std::cout << "failed (pipelined tokenizer): " << name << std::endl;
+      fail--;
+    }
+    if (pulled && !compare_expected(name, name + ".pull"))
+    {
+      std::cout << "failed (pulled tokens): " << name << std::endl;
+      fail--;
+    }
+    if (!chunked_scan(content))
+    {
+      std::cout << "failed (chunked scan): " << name << std::endl;
+      fail--;
+    }
+    if (!chunked_drop(content))
+    {
+      std::cout << "failed (chunked scan dropped): " << name << std::endl;
+      fail--;
+    }
+    if (!tokenizer_reset(content))
+    {
+      std::cout << "failed (tokenizer reset): " << name << std::endl;
+      fail--;
+    }
+    if (!binary_roundtrip(name, content))
+    {
+      std::cout << "failed (binary stream): " << name << std::endl;
+      fail--;
+    }
+    if (!source_map_check(name, content))
+    {
+      std::cout << "failed (source map): " << name << std::endl;
+      fail--;
+    }
+  }
+  if (!chunked_scan("int a; /* one\n two\n three */ int b;\n\"a\nb\" c\n#define X \\\n  1\n"
+                    "x = 'y\n z';\n/*\n\n/* nested\n*/ #if 0\n#endif\n// tail\n"))
+  {
+    std::cout << "failed: chunked scan across boundaries" << std::endl;
+    fail--;
   }
-  
+  if (!null_directives())
+  {
+    std::cout << "failed: null directives" << std::endl;
+    fail--;
+  }
+  if (!binary_roundtrip("p.integers", "#define N 0x0FF\nint a = 0xFF + 007 + 017u + 0 + -5 + +5 + 10ULL + 0X1F + N;\n"
+                                      "a <<= 2; a >>= 1; a == 3 && a != 4 || a <= 5;\n"))
+  {
+    std::cout << "failed: binary stream integers" << std::endl;
+    fail--;
+  }
+  if (!pull_early_stop())
+  {
+    std::cout << "failed: pulled tokens stopped early" << std::endl;
+    fail--;
+  }
+
+  if (!batch_all(3))
+  {
+    std::cout << "failed: batch jobs" << std::endl;
+    fail--;
+  }
+
+  if (!small_vector_ops())
+  {
+    std::cout << "failed: small vector" << std::endl;
+    fail--;
+  }
+
+  if (!call_cache())
+  {
+    std::cout << "failed: call cache" << std::endl;
+    fail--;
+  }
+
+  if (!cached_call_errors())
+  {
+    std::cout << "failed: cached call errors" << std::endl;
+    fail--;
+  }
+
+  if (!memory_resource_use())
+  {
+    std::cout << "failed: memory resource" << std::endl;
+    fail--;
+  }
+
+  if (!expansion_memory())
+  {
+    std::cout << "failed: expansion memory" << std::endl;
+    fail--;
+  }
+
+  if (!definition_memory())
+  {
+    std::cout << "failed: definition memory" << std::endl;
+    fail--;
+  }
+
+  if (!batch_null_output())
+  {
+    std::cout << "failed: batch job without output" << std::endl;
+    fail--;
+  }
+
+  if (!transform_reset())
+  {
+    std::cout << "failed: transform reset" << std::endl;
+    fail--;
+  }
+
+  if (!define_api())
+  {
+    std::cout << "failed: define api" << std::endl;
+    fail--;
+  }
+
+  if (!environment_hash())
+  {
+    std::cout << "failed: environment hash" << std::endl;
+    fail--;
+  }
+
+  if (!environment_hash_api())
+  {
+    std::cout << "failed: environment hash of api definitions" << std::endl;
+    fail--;
+  }
+
+  if (!shared_environment())
+  {
+    std::cout << "failed: shared macro environment" << std::endl;
+    fail--;
+  }
+
   return fail;
 }
\ No newline at end of file
@@ -1,7 +1,5 @@
 
-#include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 
 #define PPR_IMPLEMENT
@@ -34,11 +32,8 @@ int main(int argc, char* argv[])
     else
     {
       file = argv[i];
-      std::ifstream     ff(file);
-      std::stringstream buffer;
-      buffer << ff.rdbuf();
-      std::string content = buffer.str();
-      ppr::tokenizer ctx(content, adapter);
+      ppr::mapped_source source(file);
+      ppr::tokenizer     ctx(source.view(), adapter);
       ctx.print_tokens();
     }
   }
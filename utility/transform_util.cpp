@@ -1,71 +1,255 @@
 
-#include <fstream>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <deque>
 #include <iostream>
-#include <sstream>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #define PPR_IMPLEMENT
 #include <ppr.hpp>
 
-class sink_adapter : public ppr::sink
+// Output of one job, kept until the files before it are written
+class buffer_sink final : public ppr::range_sink
 {
 public:
-  void handle(ppr::token const& t, symvalue const& data) override
+  void handle_range(std::string_view data, bool disabled) override
   {
-    if (t.was_disabled ^ last_disabled)
+    if (disabled != in_disabled)
     {
-      if (t.was_disabled)
-        std::cout << "/* ";
-      else
-        std::cout << "*/ ";
-      last_disabled = t.was_disabled;
+      text += disabled ? "/* " : "*/ ";
+      in_disabled = disabled;
     }
-
-    std::cout << data.first << data.second;
+    text += data;
   }
 
-  void error(std::string_view s, std::string_view e, ppr::token t, ppr::loc l) override
+  void error(std::string_view s, std::string_view e, ppr::token, ppr::loc l) override
   {
-    std::cerr << "error : " << s << " - " << e << "l(" << l.line << ":" << l.column << ")" << std::endl;
+    errors += "error : ";
+    errors += s;
+    errors += " - ";
+    errors += e;
+    errors += "l(" + std::to_string(l.line) + ":" + std::to_string(l.column) + ")\n";
   }
 
+  std::string text;
+  std::string errors;
+
 private:
-  bool last_disabled = false;
+  bool in_disabled = false;
+};
+
+// Drops what it is given, errors in definitions are reported by the transform of the files
+class null_sink final : public ppr::sink
+{
+public:
+  void handle(ppr::token const&, symvalue const&) override {}
+  void error(std::string_view, std::string_view, ppr::token, ppr::loc) override {}
 };
 
+// Count given to -j or -T, exits with a usage error when it is not a number
+unsigned parse_count(std::string_view option, std::string_view value)
+{
+  unsigned n = 0;
+  auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), n);
+  if (value.empty() || ec != std::errc{} || end != value.data() + value.size())
+  {
+    std::cerr << "preprocess: " << option << " expects a number, got '" << value << "' (see --help)\n";
+    std::exit(1);
+  }
+  return n;
+}
+
+// Applies a transform option, false for any other argument
+template <typename Transform>
+bool set_option(Transform& ctx, std::string const& arg)
+{
+  if (arg == "-P")
+    ctx.set_transform_code(true);
+  else if (arg == "-D")
+    ctx.set_ignore_disabled(false);
+  else if (arg == "-C")
+    ctx.set_call_cache_limit(64 * 1024 * 1024);
+  else if (arg == "-M")
+    ctx.set_minify(true);
+  else if (arg == "-R")
+    ctx.set_disabled_ranges(true);
+  else if (arg.starts_with("-T"))
+  {
+    ctx.set_pipeline_threshold(1);
+    if (arg.size() > 2)
+      ctx.set_tokenizer_threads(parse_count("-T", std::string_view{arg}.substr(2)));
+  }
+  else
+    return false;
+  return true;
+}
+
+// Arguments with each @file replaced by the arguments it holds, separated by whitespace, double quotes
+// keep one together
+void expand_args(std::vector<std::string>& args, std::string_view arg, int depth = 0)
+{
+  if (!arg.starts_with('@') || depth > 8)
+  {
+    args.emplace_back(arg);
+    return;
+  }
+  ppr::mapped_source file(std::string{arg.substr(1)});
+  if (!file)
+  {
+    std::cerr << "unable to read " << arg.substr(1) << "\n";
+    return;
+  }
+  auto        text = file.view();
+  std::size_t i    = 0;
+  while (i < text.size())
+  {
+    if (std::isspace(static_cast<unsigned char>(text[i])))
+    {
+      ++i;
+      continue;
+    }
+    std::string next;
+    bool        quoted = false;
+    for (; i < text.size() && (quoted || !std::isspace(static_cast<unsigned char>(text[i]))); ++i)
+    {
+      if (text[i] == '"')
+        quoted = !quoted;
+      else
+        next += text[i];
+    }
+    expand_args(args, next, depth + 1);
+  }
+}
+
+// -DNAME[=VALUE] and -UNAME, a name alone is defined as 1. Plain -D is the disabled code option.
+template <typename Transform>
+bool set_macro(Transform& ctx, std::string const& arg)
+{
+  if (arg.size() <= 2 || !(arg.starts_with("-D") || arg.starts_with("-U")))
+    return false;
+  std::string_view def{arg};
+  def.remove_prefix(2);
+  if (arg[1] == 'U')
+    ctx.undefine(def);
+  else if (auto eq = def.find('='); eq != def.npos)
+    ctx.define(def.substr(0, eq), def.substr(eq + 1));
+  else
+    ctx.define(def, "1");
+  return true;
+}
+
+// Each file on its own, on a pool of threads, written out in the order given
+void run_jobs(std::vector<std::string> const& files, std::vector<std::string> const& options,
+              std::shared_ptr<ppr::macro_environment const> const& defines, bool keep_comments, unsigned threads)
+{
+  std::vector<ppr::mapped_source> sources;
+  std::deque<buffer_sink>         sinks;
+  std::vector<ppr::batch::job>    jobs;
+  for (auto const& file : files)
+  {
+    auto& source = sources.emplace_back(file);
+    auto& out    = sinks.emplace_back();
+    out.set_ignore_comments(!keep_comments);
+    jobs.push_back({source.view(), defines, &out});
+  }
+
+  std::mutex        lock;
+  std::size_t       written = 0;
+  std::vector<char> finished(files.size(), 0);
+  ppr::batch        b(threads);
+  b.set_setup(
+      [&](ppr::transform& ctx, std::size_t)
+      {
+        for (auto const& o : options)
+          set_option(ctx, o);
+      });
+  b.set_done(
+      [&](std::size_t i)
+      {
+        std::lock_guard guard(lock);
+        finished[i] = 1;
+        for (; written < files.size() && finished[written]; ++written)
+        {
+          auto& out = sinks[written];
+          std::cout.write(out.text.data(), static_cast<std::streamsize>(out.text.size()));
+          std::cerr.write(out.errors.data(), static_cast<std::streamsize>(out.errors.size()));
+          out.text         = {};
+          out.errors       = {};
+          sources[written] = {};
+        }
+      });
+  b.run(jobs);
+  std::cout.flush();
+}
 
 int main(int argc, char* argv[])
 {
-  sink_adapter   adapter;
-  std::string file;
-  ppr::transform ctx(adapter);
+  ppr::fd_sink                       adapter;
+  std::string                        file;
+  ppr::basic_transform<ppr::fd_sink> ctx(adapter);
+  null_sink                          quiet;
+  // Definitions from the command line the jobs start with
+  ppr::transform                     defines(quiet);
+  std::vector<std::string>           args;
+  std::vector<std::string>           options;
+  std::vector<std::string>           files;
+  unsigned                           threads       = 0;
+  bool                               keep_comments = false;
 
   for (int i = 1; i < argc; ++i)
+    expand_args(args, argv[i]);
+
+  for (std::size_t i = 0; i < args.size(); ++i)
   {
-    if (std::string(argv[i]) == "-P")
-      ctx.set_transform_code(true);
-    else if (std::string(argv[i]) == "-D")
-      ctx.set_ignore_disabled(false);
-    else if (std::string(argv[i]) == "-K")
+    auto const& arg = args[i];
+    if (set_option(ctx, arg))
+      options.push_back(arg);
+    else if (set_macro(ctx, arg))
+      set_macro(defines, arg);
+    else if (arg == "-K")
+    {
       adapter.set_ignore_comments(false);
-    else if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-H")
+      keep_comments = true;
+    }
+    else if (arg.starts_with("-j"))
     {
-      std::cout << "preprocess [-T] [-I] [-K] [--help, -H] file1 file2\n"
+      auto count = std::string_view{arg}.substr(2);
+      if (count.empty() && i + 1 < args.size())
+        count = args[++i];
+      threads = parse_count("-j", count);
+    }
+    else if (arg == "--help" || arg == "-H")
+    {
+      std::cout << "preprocess [-T] [-I] [-K] [-C] [-M] [-R] [-j N] [-DNAME[=VALUE]] [-UNAME] [@file] [--help, -H] "
+                   "file1 file2\n"
                    "  -P preprocess macro usage in code (experimental)\n"
                    "  -D dont ignore disabled code (print them)\n"
-                   "  -K dont ignore comments (print them)\n";
+                   "  -DNAME[=VALUE] define NAME as VALUE, 1 when there is no value, -UNAME undefine it\n"
+                   "  @file read more arguments from file\n"
+                   "  -K dont ignore comments (print them)\n"
+                   "  -C cache function-like macro call expansions\n"
+                   "  -M minify, drop comments and redundant whitespace\n"
+                   "  -R with -D, print disabled code as it is in the source\n"
+                   "  -T tokenize on a separate thread, -TN with N threads on chunks of the file\n"
+                   "  -j N preprocess the files that follow on N threads, each without the macros of the others,\n"
+                   "       with all of the options given; output keeps the order of the files\n";
       std::exit(0);
     }
+    else if (threads)
+      files.push_back(arg);
     else
     {
-      file = argv[i];
-      std::ifstream     ff(file);
-      std::stringstream buffer;
-      buffer << ff.rdbuf();
-      std::string    content = buffer.str();
-      ctx.preprocess(content);    
+      file = arg;
+      ppr::mapped_source source(file);
+      adapter.reserve(source.size());
+      ctx.preprocess(source.view());
     }
   }
-  
+
+  if (!files.empty())
+    run_jobs(files, options, defines.freeze(), keep_comments, threads);
   return 0;
-}
\ No newline at end of file
+}